@@ -1,9 +1,21 @@
 // optimized_multi_core_pi.cpp
 // Optimized for Raspberry Pi Zero 2W (Cortex-A53, 512MB RAM, ~32KB L1 cache)
 // - Bit-packed flags (8x memory reduction)
-// - Smaller segments for L1 cache fit
+// - Smaller segments for L1 cache fit, geometry picked from the cache sizes at startup
 // - Loop unrolling in hot paths
-// - Simple odd-only sieve (no complex wheel)
+// - NEON / AVX2 / AVX-512 popcount and top-bit scan kernels, runtime dispatch on x86
+// - Selectable segment layout: odd-only, mod-30 or mod-210 wheel
+// - Segments initialised from a pre-sieved small-prime pattern
+// - Branch-free word-mask kernels for the next primes below 64
+// - Bucket sieve for base primes larger than a segment
+// - Optional compact (varint gap) prime stream on a writer thread
+// - Optional mmap'd segment bitmap archive with pi(x) / nth-prime queries
+// - Optional worker pinning, one CPU per physical core first
+// - Optional heartbeat: LED toggle, status line or UDP datagram from a monitor thread
+// - Optional temperature / clock / power sampling, primes per joule, throttle governor
+// - Optional cluster mode: a TCP coordinator leasing ranges to worker processes
+// - Built-in --verify (reference recount + Miller-Rabin) and --bench harness
+// - Engines usable in-process through the header-only prime_sieve.hpp
 // - Portable code (compiles on any system)
 //
 // Build for Pi Zero 2W:
@@ -12,322 +24,1828 @@
 // Build for other systems:
 //   g++ -O3 -pipe -flto -fno-exceptions -fno-rtti -march=native -funroll-loops -DNDEBUG -pthread optimized_multi_core_pi.cpp -o optimized_mc_pi
 //
+// Add -DSIEVE_PROFILE for a per-phase time breakdown at exit (and --perf
+// for hardware cache / branch-miss counters on Linux).
+//
 // Usage:
-//   ./optimized_mc_pi [seconds=10] [threads=3]
+//   ./optimized_mc_pi [seconds=10] [threads=3] [--engine odd|wheel30|wheel210]
+//                     [--start A]   timed run upwards from A instead of 0
+//                     [--alloc contiguous|interleaved] [--output primes.pvar]
+//                     [--segment auto|calibrate|16k|32k|128k|512k]   segment geometry
+//                     [--scalar]   force the portable popcount/scan kernels
+//                     [--no-huge-pages]   plain pages for the sieve arenas
+//                     [--pin] [--keep-core-free]   worker CPU placement
+//                     [--monitor led:ACT|gpio:N|status|udp:HOST:PORT[,...] [--monitor-every 60]]
+//                     [--thermal] [--thermal-log FILE] [--power FILE]   temperature, clock, energy per tick
+//                     [--governor [--throttle-temp C]]   park workers near the throttle point
+//   ./optimized_mc_pi --range A B [threads=3] [options]   count primes in [A, B]
+//   ./optimized_mc_pi --up-to N [threads=3] [options]     pi(N), e.g. --up-to 1e10
+//                     [--archive primes.parc]             keep segment bitmaps for queries
+//   ./optimized_mc_pi --query primes.parc pi X | nth K | primes A B
+//   ./optimized_mc_pi --serve PORT --range A B | --up-to N [--lease-span 1e10] [--lease-timeout 600]
+//                     [--tuples] [--gaps FILE]            coordinate a range over TCP workers
+//   ./optimized_mc_pi --connect HOST:PORT [threads=3] [--engine ...] [--segment ...]   sieve its leases
+//   ./optimized_mc_pi --bench [--x 1e9,1e10] [--threads 1,3] [--engines ...] [--segments ...]
+//                     [--reps 5] [--json FILE] [--baseline FILE [--max-regress 5]]
+//   [--checkpoint FILE [--checkpoint-every 60]]   periodic resumable state
+//   [--resume FILE]                               continue from a checkpoint
+//   [--perf]                                      hardware counters (SIEVE_PROFILE builds)
+//   [--verify [--verify-every 64]]                recount sampled segments, Miller-Rabin their primes
+//   [--stats-lite]                                find the largest prime at the end, not per segment
+//   [--tuples]                                    twin / cousin / sexy pairs and the largest gap
+//   [--gaps FILE]                                 gap histogram and maximal gaps, written to FILE
+//
+// The engines themselves live in prime_sieve.hpp; this file is the CLI.
 
-#include <bits/stdc++.h>
-#include <atomic>
-#include <thread>
-#include <mutex>
+#include "prime_sieve.hpp"
+#include <cerrno>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
 
+using namespace prime_sieve;
 using namespace std;
 
-using u8  = uint8_t;
-using u32 = uint32_t;
-using u64 = uint64_t;
-
-// -------------------- Bit manipulation --------------------
-static inline void clear_bit(u64* arr, size_t bit) {
-    arr[bit >> 6] &= ~(1ULL << (bit & 63));
+// -------------------- Live progress monitor --------------------
+// A monitor thread wakes every few seconds, takes a progress_snapshot() and
+// hands it to its sinks; the workers never see it (no locks, no syscalls on
+// their side). Sinks:
+//   led:NAME      toggle /sys/class/leds/NAME (e.g. led:ACT on a Pi)
+//   gpio:N        toggle /sys/class/gpio/gpioN/value (exported beforehand)
+//   status        one overwritten status line on stderr
+//   udp:HOST:PORT one text datagram per tick to a collector
+// sysfs writes are best effort: a missing LED is not worth stopping for
+static void sysfs_put(int fd, const char* v) {
+    if (pwrite(fd, v, strlen(v), 0) < 0) return;
 }
 
-static inline bool test_bit(const u64* arr, size_t bit) {
-    return (arr[bit >> 6] >> (bit & 63)) & 1;
-}
+struct MonitorSink {
+    enum Kind { LED, STATUS, UDP } kind = STATUS;
+    int fd = -1;
+    bool lit = false;
+    sockaddr_storage addr{};
+    socklen_t addr_len = 0;
 
-// Fast bit counting - portable version
-static u64 popcount_array(const u64* arr, size_t n_u64) {
-    u64 total = 0;
-    
-    // Unroll by 4 for better performance
-    size_t i = 0;
-    for (; i + 3 < n_u64; i += 4) {
-        total += __builtin_popcountll(arr[i]);
-        total += __builtin_popcountll(arr[i + 1]);
-        total += __builtin_popcountll(arr[i + 2]);
-        total += __builtin_popcountll(arr[i + 3]);
+    bool open(const string& spec) {
+        if (spec == "status") {
+            kind = STATUS;
+            return true;
+        }
+        if (spec.rfind("led:", 0) == 0 || spec.rfind("gpio:", 0) == 0) {
+            kind = LED;
+            if (spec[0] == 'l') {
+                string dir = "/sys/class/leds/" + spec.substr(4) + "/";
+                fd = ::open((dir + "brightness").c_str(), O_WRONLY);
+                if (fd < 0) return false;
+                // Take the LED over from its kernel trigger (mmc0 on a Pi)
+                int t = ::open((dir + "trigger").c_str(), O_WRONLY);
+                if (t >= 0) {
+                    sysfs_put(t, "none");
+                    ::close(t);
+                }
+                return true;
+            }
+            fd = ::open(("/sys/class/gpio/gpio" + spec.substr(5) + "/value").c_str(), O_WRONLY);
+            return fd >= 0;
+        }
+        if (spec.rfind("udp:", 0) == 0) {
+            kind = UDP;
+            size_t colon = spec.rfind(':');
+            if (colon <= 4) return false;
+            string host = spec.substr(4, colon - 4), port = spec.substr(colon + 1);
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_DGRAM;
+            addrinfo* res = nullptr;
+            if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res) return false;
+            fd = socket(res->ai_family, SOCK_DGRAM, 0);
+            memcpy(&addr, res->ai_addr, res->ai_addrlen);
+            addr_len = (socklen_t)res->ai_addrlen;
+            freeaddrinfo(res);
+            return fd >= 0;
+        }
+        return false;
     }
-    
-    // Handle remainder
-    for (; i < n_u64; ++i) {
-        total += __builtin_popcountll(arr[i]);
+
+    // extra: the thermal fields of this tick, or ""
+    void publish(const ProgressSnapshot& s, double elapsed, double rate, const char* extra) {
+        char line[384];
+        int n = snprintf(line, sizeof(line), "%.0fs primes=%llu segments=%llu n=%llu rate=%.3g/s%s",
+                         elapsed, (unsigned long long)s.primes, (unsigned long long)s.segments,
+                         (unsigned long long)s.max_hi, rate, extra);
+        n = min(n, (int)sizeof(line) - 1);
+        switch (kind) {
+            case LED:
+                lit = !lit;
+                sysfs_put(fd, lit ? "1" : "0");
+                break;
+            case STATUS:
+                fprintf(stderr, "\r%s\033[K", line);
+                fflush(stderr);
+                break;
+            case UDP:
+                sendto(fd, line, (size_t)n, 0, (const sockaddr*)&addr, addr_len);
+                break;
+        }
     }
-    
-    return total;
+
+    void close() {
+        if (kind == STATUS) fputc('\n', stderr);
+        if (kind == LED && fd >= 0 && lit) sysfs_put(fd, "0");
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+};
+
+// -------------------- Thermal, frequency and power --------------------
+// With --thermal the monitor also samples, once per tick:
+//   temperature  the CPU's thermal zone (or vcgencmd measure_temp)
+//   frequency    mean scaling_cur_freq over the CPUs (or vcgencmd measure_clock arm)
+//   throttling   vcgencmd get_throttled on a Pi; elsewhere a frequency 5% below
+//                the run's peak, or a temperature at the throttle point
+//   power        --power FILE: microwatts (hwmon power*_input, or a logger
+//                writing a USB meter's reading) or a powercap energy_uj counter
+// and logs primes/s against them per interval (--thermal-log FILE). The
+// throttle point is the zone's passive trip point, else 80 C, where the Pi
+// firmware starts to throttle. The governor (--governor) parks one worker
+// each tick within 5 C of it and lets one back in 10 C below, trading burst
+// speed for a clock that holds.
+static string read_line(const string& path) {
+    ifstream in(path);
+    string line;
+    getline(in, line);
+    return line;
 }
 
-// -------------------- Shared base primes --------------------
-struct BasePrimes {
-    vector<u32> primes;
-    u32 sieved_to = 1;
-    mutex mtx;
+static double read_number(const string& path) {
+    string line = read_line(path);
+    char* end = nullptr;
+    double v = strtod(line.c_str(), &end);
+    return end == line.c_str() ? NAN : v;
+}
 
-    void ensure(u32 new_need) {
-        if (new_need <= sieved_to) return;
-        lock_guard<mutex> lk(mtx);
-        if (new_need <= sieved_to) return;
+// Output of a short command, "" when it cannot run
+static string run_command(const char* cmd) {
+    string out;
+    FILE* p = popen(cmd, "r");
+    if (!p) return out;
+    char buf[256];
+    while (fgets(buf, sizeof(buf), p)) out += buf;
+    pclose(p);
+    return out;
+}
+
+// The number after '=' in vcgencmd's "temp=47.2'C" style replies
+static double vcgencmd_value(const char* cmd, int base = 10) {
+    string out = run_command(cmd);
+    size_t eq = out.find('=');
+    if (eq == string::npos) return NAN;
+    char* end = nullptr;
+    const char* v = out.c_str() + eq + 1;
+    double x = base == 16 ? (double)strtoull(v, &end, 16) : strtod(v, &end);
+    return end == v ? NAN : x;
+}
+
+struct ThermalSample {
+    double t = 0;               // Seconds since the run started
+    u64 primes = 0;             // Progress total at t
+    double rate = 0;            // Primes per second since the previous sample
+    double temp_c = NAN;
+    double mhz = NAN;
+    double watts = NAN;         // Mean since the previous sample
+    bool throttled = false;
+    unsigned threads = 0;       // Governor's active workers after this sample
+};
 
-        u32 target = max<u32>(new_need, sieved_to ? min<u32>(numeric_limits<u32>::max(), sieved_to * 2u) : new_need);
+struct Thermal {
+    // Sources, found by open()
+    string temp_path;               // thermal_zoneN/temp, millidegrees C
+    vector<string> freq_paths;      // cpuN/cpufreq/scaling_cur_freq, kHz
+    bool vcgencmd = false;          // Raspberry Pi firmware tool on PATH
+    string power_path;
+    bool energy_counter = false;    // energy_uj, else microwatts
+    double energy_range = 0;        // Counter wrap, microjoules
+    double throttle_c = 80.0;
+    FILE* log = nullptr;
 
-        // Simple sieve for base primes
-        vector<u8> mark(target + 1, 1);
-        if (target >= 0) mark[0] = 0;
-        if (target >= 1) mark[1] = 0;
+    // Governor: workers [0, *active) claim chunks
+    std::atomic<unsigned>* active = nullptr;
+    unsigned max_threads = 1;
+    unsigned min_threads = 1;
+    u32 changes = 0;
+    static constexpr double MARGIN = 5.0;
+
+    vector<ThermalSample> samples;  // samples[0] is the baseline at t = 0
+    double joules = 0;
+    double peak_mhz = 0;
+    double last_energy = NAN;
+
+    // throttle_temp <= 0 takes the trip point. Returns the flag whose source
+    // failed ("--power" or "--thermal-log"), nullptr when every source opened
+    const char* open(const char* power, const char* log_path, double throttle_temp) {
+#ifdef __linux__
+        bool cpu_zone = false;
+        for (int z = 0; z < 64 && !cpu_zone; ++z) {
+            string dir = "/sys/class/thermal/thermal_zone" + to_string(z) + "/";
+            string type = read_line(dir + "type");
+            if (type.empty() || std::isnan(read_number(dir + "temp"))) continue;
+            cpu_zone = type.find("cpu") != string::npos || type.find("soc") != string::npos || type == "x86_pkg_temp";
+            if (!temp_path.empty() && !cpu_zone) continue;
+            temp_path = dir + "temp";
+            for (int k = 0; k < 16; ++k) {
+                string trip = dir + "trip_point_" + to_string(k) + "_";
+                if (read_line(trip + "type") != "passive") continue;
+                double c = read_number(trip + "temp") / 1000.0;
+                if (c > 0) throttle_c = c;
+                break;
+            }
+        }
+        unsigned cpus = max(1u, std::thread::hardware_concurrency());
+        for (unsigned c = 0; c < cpus; ++c) {
+            string path = "/sys/devices/system/cpu/cpu" + to_string(c) + "/cpufreq/scaling_cur_freq";
+            if (read_number(path) > 0) freq_paths.push_back(path);
+        }
+#endif
+        vcgencmd = run_command("vcgencmd get_throttled 2>/dev/null").rfind("throttled=", 0) == 0;
+        if (throttle_temp > 0) throttle_c = throttle_temp;
+        if (power) {
+            power_path = power;
+            if (std::isnan(read_number(power_path))) return "--power";
+            size_t slash = power_path.rfind('/');
+            string base = slash == string::npos ? power_path : power_path.substr(slash + 1);
+            energy_counter = base == "energy_uj";
+            if (energy_counter) {
+                energy_range = read_number(power_path.substr(0, slash + 1) + "max_energy_range_uj");
+                if (std::isnan(energy_range)) energy_range = 0;
+            }
+        }
+        if (log_path) {
+            log = fopen(log_path, "w");
+            if (!log) return "--thermal-log";
+            fprintf(log, "# t_s primes_per_s temp_c mhz throttled watts threads\n");
+        }
+        return nullptr;
+    }
+
+    // Reads every source; appends this tick's fields to extra for the sinks
+    void sample(const ProgressSnapshot& s, double t, char* extra, size_t extra_size) {
+        ThermalSample x;
+        x.t = t;
+        x.primes = s.primes;
+        if (!temp_path.empty()) x.temp_c = read_number(temp_path) / 1000.0;
+        else if (vcgencmd) x.temp_c = vcgencmd_value("vcgencmd measure_temp 2>/dev/null");
+        if (!freq_paths.empty()) {
+            double khz = 0;
+            for (const auto& p : freq_paths) khz += read_number(p);
+            x.mhz = khz / freq_paths.size() / 1000.0;
+        } else if (vcgencmd) {
+            x.mhz = vcgencmd_value("vcgencmd measure_clock arm 2>/dev/null") / 1e6;
+        }
+        // Under-voltage, frequency capped, throttled, soft temperature limit
+        double flags = vcgencmd ? vcgencmd_value("vcgencmd get_throttled 2>/dev/null", 16) : NAN;
+        if (!std::isnan(flags)) x.throttled = ((u64)flags & 0xF) != 0;
+        else x.throttled = x.mhz < 0.95 * peak_mhz;
+        if (x.temp_c >= throttle_c) x.throttled = true;
+        if (x.mhz > peak_mhz) peak_mhz = x.mhz;
+
+        if (!samples.empty()) {
+            const ThermalSample& prev = samples.back();
+            double dt = t - prev.t;
+            if (dt > 0) x.rate = (s.primes - prev.primes) / dt;
+            if (!power_path.empty() && dt > 0) {
+                double v = read_number(power_path);
+                if (energy_counter) {
+                    if (!std::isnan(v) && !std::isnan(last_energy)) {
+                        double d = v - last_energy;
+                        if (d < 0) d += energy_range;
+                        joules += d / 1e6;
+                        x.watts = d / 1e6 / dt;
+                    }
+                    last_energy = v;
+                } else if (!std::isnan(v)) {
+                    x.watts = v / 1e6;
+                    if (!std::isnan(prev.watts)) joules += (x.watts + prev.watts) / 2 * dt;
+                }
+            }
+        } else if (energy_counter) {
+            last_energy = read_number(power_path);
+        } else if (!power_path.empty()) {
+            x.watts = read_number(power_path) / 1e6;
+        }
 
-        for (u32 p : primes) {
-            u64 start = (u64)p * (u64)p;
-            if (start > target) break;
-            for (u64 j = start; j <= target; j += p) mark[(size_t)j] = 0;
+        if (active && !std::isnan(x.temp_c)) {
+            unsigned a = active->load(std::memory_order_relaxed), was = a;
+            if (x.temp_c >= throttle_c - MARGIN && a > 1) --a;
+            else if (x.temp_c < throttle_c - 2 * MARGIN && a < max_threads) ++a;
+            if (a != was) {
+                active->store(a, std::memory_order_relaxed);
+                ++changes;
+                min_threads = min(min_threads, a);
+            }
         }
+        x.threads = active ? active->load(std::memory_order_relaxed) : 0;
+        samples.push_back(x);
 
-        for (u32 i = 2; (u64)i * i <= target; ++i) {
-            if (!mark[i]) continue;
-            u64 start = (u64)i * (u64)i;
-            for (u64 j = start; j <= target; j += i) mark[(size_t)j] = 0;
+        char temp[16] = "-", mhz[16] = "-", watts[16] = "-";
+        if (!std::isnan(x.temp_c)) snprintf(temp, sizeof(temp), "%.1f", x.temp_c);
+        if (!std::isnan(x.mhz)) snprintf(mhz, sizeof(mhz), "%.0f", x.mhz);
+        if (!std::isnan(x.watts)) snprintf(watts, sizeof(watts), "%.3f", x.watts);
+        if (log && samples.size() > 1) {
+            fprintf(log, "%.1f %.4g %s %s %d %s %u\n", t, x.rate, temp, mhz, x.throttled ? 1 : 0, watts, x.threads);
+            fflush(log);
         }
+        int n = snprintf(extra, extra_size, " temp=%sC mhz=%s%s", temp, mhz, x.throttled ? " THROTTLED" : "");
+        if (!power_path.empty() && n >= 0 && (size_t)n < extra_size) snprintf(extra + n, extra_size - n, " watts=%s", watts);
+    }
 
-        primes.clear();
-        for (u32 i = 2; i <= target; ++i) {
-            if (mark[i]) primes.push_back(i);
+    // Summary over the sampled intervals; primes for primes per joule
+    void report(u64 primes) const {
+        if (samples.size() < 2) {
+            cout << "Thermal: no interval sampled (run shorter than --monitor-every)\n";
+            return;
+        }
+        double t_lo = NAN, t_hi = NAN, f_lo = NAN, f_hi = NAN;
+        double th_s = 0, th_primes = 0, ok_s = 0, ok_primes = 0, first_th = -1;
+        u32 th_n = 0;
+        map<long, pair<double, double>> by_mhz;     // 50 MHz bin -> seconds, primes
+        for (size_t i = 1; i < samples.size(); ++i) {
+            const ThermalSample& x = samples[i];
+            double dt = x.t - samples[i - 1].t, dp = (double)(x.primes - samples[i - 1].primes);
+            if (!std::isnan(x.temp_c)) {
+                t_lo = std::isnan(t_lo) ? x.temp_c : min(t_lo, x.temp_c);
+                t_hi = std::isnan(t_hi) ? x.temp_c : max(t_hi, x.temp_c);
+            }
+            if (!std::isnan(x.mhz)) {
+                f_lo = std::isnan(f_lo) ? x.mhz : min(f_lo, x.mhz);
+                f_hi = std::isnan(f_hi) ? x.mhz : max(f_hi, x.mhz);
+                auto& b = by_mhz[lround(x.mhz / 50) * 50];
+                b.first += dt;
+                b.second += dp;
+            }
+            if (x.throttled) {
+                if (first_th < 0) first_th = samples[i - 1].t;
+                ++th_n;
+                th_s += dt;
+                th_primes += dp;
+            } else {
+                ok_s += dt;
+                ok_primes += dp;
+            }
+        }
+        ios::fmtflags flags = cout.flags();
+        streamsize precision = cout.precision();
+        cout << fixed << setprecision(1) << "Thermal: ";
+        if (std::isnan(t_lo)) cout << "no temperature";
+        else cout << t_lo << "-" << t_hi << " C";
+        cout << " (throttle point " << throttle_c << " C), " << setprecision(0);
+        if (std::isnan(f_lo)) cout << "no frequency";
+        else cout << f_lo << "-" << f_hi << " MHz";
+        cout << " over " << samples.size() - 1 << " intervals\n";
+        if (th_n) {
+            cout << "Throttled: " << th_n << " intervals, " << th_s << " s (first at " << first_th << " s); "
+                 << defaultfloat << setprecision(3) << (th_s > 0 ? th_primes / th_s : 0.0) << " primes/s vs "
+                 << (ok_s > 0 ? ok_primes / ok_s : 0.0) << " otherwise\n";
+        } else {
+            cout << "Throttled: none\n";
+        }
+        if (!by_mhz.empty()) {
+            cout << "Rate by frequency:";
+            for (auto it = by_mhz.rbegin(); it != by_mhz.rend(); ++it) {
+                cout << " " << it->first << " MHz " << defaultfloat << setprecision(3)
+                     << (it->second.first > 0 ? it->second.second / it->second.first : 0.0) << "/s (" << fixed
+                     << setprecision(0) << it->second.first << " s)";
+            }
+            cout << "\n";
+        }
+        if (!power_path.empty()) {
+            double span = samples.back().t - samples.front().t;
+            cout << "Energy: " << fixed << setprecision(1) << joules << " J over " << span << " s, "
+                 << setprecision(2) << (span > 0 ? joules / span : 0.0) << " W mean, " << defaultfloat
+                 << setprecision(4) << (joules > 0 ? primes / joules : 0.0) << " primes/J\n";
         }
+        cout.flags(flags);
+        cout.precision(precision);
+    }
 
-        sieved_to = target;
+    void close() {
+        if (log) fclose(log);
+        log = nullptr;
     }
 };
 
-// -------------------- Work allocator --------------------
-struct WorkAllocator {
-    // Optimized for L1 cache (32KB) - bit-packed allows more coverage
-    static constexpr size_t SEG_BYTES  = 16 * 1024;      // 16KB total storage
-    static constexpr size_t SEG_U64S   = SEG_BYTES / 8;  // 2048 u64 elements
-    static constexpr u64    SEG_BITS   = SEG_BYTES * 8;  // 131072 bit positions
-    static constexpr u64    SEG_ODDS   = SEG_BITS;       // One bit per odd number
-    static constexpr u64    SEG_SPAN   = SEG_ODDS * 2;   // Range covered (262144)
-    static constexpr int    CHUNK_SEGS = 32;             // Segments per chunk
-    static constexpr u64    CHUNK_SPAN = SEG_SPAN * CHUNK_SEGS;
+struct Monitor {
+    vector<MonitorSink> sinks;
+    double every = 60.0;
+    Thermal* thermal = nullptr;     // Sampled every tick when set
+
+    mutex mtx;
+    condition_variable cv;
+    bool stopping = false;
+    thread th;
 
-    std::atomic<uint32_t> next_chunk{0};
+    // Comma-separated sink list, see above
+    bool open(const string& specs) {
+        size_t pos = 0;
+        while (pos <= specs.size()) {
+            size_t comma = specs.find(',', pos);
+            if (comma == string::npos) comma = specs.size();
+            MonitorSink sink;
+            if (!sink.open(specs.substr(pos, comma - pos))) return false;
+            sinks.push_back(sink);
+            pos = comma + 1;
+        }
+        return !sinks.empty();
+    }
 
-    u64 get_chunk() {
-        uint32_t id = next_chunk.fetch_add(1, std::memory_order_relaxed);
-        return 3 + (u64)id * CHUNK_SPAN; // Start at 3
+    void start(const ThreadResult* results, size_t n) {
+        th = thread([this, results, n] {
+            auto t0 = chrono::steady_clock::now();
+            double last_t = 0.0;
+            u64 last_hi = 0;
+            char extra[128] = "";
+            if (thermal) thermal->sample(progress_snapshot(results, n), 0.0, extra, sizeof(extra));
+            unique_lock<mutex> lk(mtx);
+            while (!cv.wait_for(lk, chrono::duration<double>(every), [&] { return stopping; })) {
+                ProgressSnapshot s = progress_snapshot(results, n);
+                double t = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+                double rate = (t > last_t && s.max_hi > last_hi && last_hi) ? (s.max_hi - last_hi) / (t - last_t) : 0.0;
+                if (thermal) thermal->sample(s, t, extra, sizeof(extra));
+                for (auto& sink : sinks) sink.publish(s, t, rate, extra);
+                last_t = t;
+                last_hi = s.max_hi;
+            }
+            // One last interval up to the stop, for the energy total
+            double t = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+            if (thermal && t > last_t + 0.1) thermal->sample(progress_snapshot(results, n), t, extra, sizeof(extra));
+        });
+    }
+
+    void stop() {
+        if (th.joinable()) {
+            {
+                lock_guard<mutex> lk(mtx);
+                stopping = true;
+            }
+            cv.notify_all();
+            th.join();
+        }
+        for (auto& sink : sinks) sink.close();
     }
 };
 
-// -------------------- Thread worker --------------------
-struct ThreadResult {
-    u64 primes_count = 0;
-    u64 largest_prime = 0;
-    u64 segments_processed = 0;
-    u64 bytes_touched = 0;
-    u64 max_hi_processed = 0;
+// -------------------- main --------------------
+// Accepts plain integers and exact scientific notation such as 1e10
+static bool parse_u64(const char* s, u64& out) {
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end != s && *end == '\0' && errno == 0 && s[0] != '-') {
+        out = v;
+        return true;
+    }
+    long double d = strtold(s, &end);
+    if (end == s || *end != '\0' || !(d >= 0) || d > 18446744073709551615.0L || d != floorl(d)) {
+        return false;
+    }
+    out = (u64)d;
+    return true;
+}
+
+// One "gap count" line per non-empty bin, then the maximal gaps in order
+static bool write_gaps(const char* path, const GapHistogram& hist, const vector<GapRecord>& records) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "# gap count\n");
+    for (u32 k = 0; k < GapHistogram::BINS; ++k) {
+        if (!hist.count[k]) continue;
+        u64 gap = k ? 2ull * k : 1;
+        fprintf(f, "%llu%s %llu\n", (unsigned long long)gap, k + 1 == GapHistogram::BINS ? "+" : "",
+                (unsigned long long)hist.count[k]);
+    }
+    fprintf(f, "# maximal gaps: gap after\n");
+    for (const auto& r : records) {
+        fprintf(f, "record %llu %llu\n", (unsigned long long)r.gap, (unsigned long long)r.after);
+    }
+    return fclose(f) == 0;
+}
+
+static int run_query(int argc, char** argv, int i) {
+    if (i + 2 >= argc) {
+        cerr << "Usage: --query FILE pi X | nth K | primes A B\n";
+        return 1;
+    }
+    PrimeArchive ar;
+    if (!ar.open_read(argv[i])) {
+        cerr << "Cannot read a complete archive from '" << argv[i] << "'\n";
+        return 1;
+    }
+    string op = argv[i + 1];
+    u64 a = 0, b = 0;
+    if (!parse_u64(argv[i + 2], a) || (op == "primes" && (i + 3 >= argc || !parse_u64(argv[i + 3], b)))) {
+        cerr << "Bad query arguments\n";
+        return 1;
+    }
+    int rc = 1;
+    const EngineInfo* info = nullptr;
+    for (const auto& e : ENGINES) {
+        if (e.modulus == ar.hdr->modulus && e.seg_bits == ar.hdr->seg_bits) info = &e;
+    }
+    if (info) {
+        rc = info->query(ar, op, a, b);
+    } else {
+        cerr << "Unsupported archive layout mod " << ar.hdr->modulus << ", " << ar.hdr->seg_bits
+             << " bits per segment\n";
+    }
+    ar.close();
+    return rc;
+}
+
+// -------------------- Benchmark --------------------
+// ./optimized_mc_pi --bench [--x 1e9,1e10] [--threads 1,3] [--engines odd,wheel30]
+//                   [--segments auto,16k] [--reps 5] [--json FILE]
+//                   [--baseline FILE [--max-regress 5]]
+// Sweeps every combination over pi(x) runs from 0: one warm-up plus --reps
+// timed repetitions each, checked against known pi(10^k), reported as one
+// JSON object per line. With a baseline (an earlier --json file) the run
+// fails if any matching configuration lost more than --max-regress percent
+// of its primes/s. The bucket sieve is always on, so it is not a variant.
+static constexpr u64 KNOWN_PI[] = {
+    0, 4, 25, 168, 1229, 9592, 78498, 664579, 5761455, 50847534, 455052511,
+    4118054813ULL, 37607912018ULL, 346065536839ULL, 3204941750802ULL,
 };
 
-static void worker(double seconds,
-                   BasePrimes* base_shared,
-                   WorkAllocator* alloc,
-                   ThreadResult* out)
-{
-    using clock = chrono::steady_clock;
-    auto t0 = clock::now();
-    auto deadline = t0 + chrono::duration<double>(seconds);
-
-    // Bit-packed flags - one bit per odd number
-    vector<u64> flags(WorkAllocator::SEG_U64S);
-    vector<u64> next_mult;
-    next_mult.reserve(1<<16);
-
-    u64 local_count = 0;
-    u64 local_largest = 0;
-    u64 local_segments = 0;
-    u64 local_bytes = 0;
-    u64 local_max_hi = 0;
-    
-    // Count 2 once
-    static bool counted_two = false;
-    static mutex two_mutex;
-    {
-        lock_guard<mutex> lk(two_mutex);
-        if (!counted_two) {
-            local_count = 1; // Just 2
-            local_largest = 2;
-            counted_two = true;
-        }
-    }
-
-    while (clock::now() < deadline) {
-        u64 chunk_lo = alloc->get_chunk();
-        
-        for (int seg = 0; seg < WorkAllocator::CHUNK_SEGS; ++seg) {
-            u64 lo = chunk_lo + seg * WorkAllocator::SEG_SPAN;
-            u64 hi = lo + WorkAllocator::SEG_SPAN;
-            
-            // Make lo odd
-            u64 lo_odd = lo | 1ULL;
-
-            // Ensure base primes cover sqrt(hi-1)
-            u64 need64 = (u64)floor(sqrt((long double)(hi - 1)));
-            u32 need = (need64 > numeric_limits<u32>::max()) ? numeric_limits<u32>::max() : (u32)need64;
-            base_shared->ensure(need);
-
-            // Initialize next_mult for new primes
-            if (next_mult.size() != base_shared->primes.size()) {
-                size_t old = next_mult.size();
-                next_mult.resize(base_shared->primes.size(), 0);
-                for (size_t i = old; i < base_shared->primes.size(); ++i) {
-                    u32 p = base_shared->primes[i];
-                    if (p == 2) {
-                        next_mult[i] = 0; // Skip 2, all evens are composite
-                        continue;
-                    }
-                    // Find first odd multiple of p >= lo_odd
-                    u64 m = ((lo_odd + p - 1) / p) * p;
-                    if ((m & 1) == 0) m += p; // Make it odd
-                    next_mult[i] = m;
-                }
-            }
+// pi(x) if x is a power of ten we know, else ~0
+static u64 known_pi(u64 x) {
+    u64 p10 = 1;
+    for (u64 v : KNOWN_PI) {
+        if (p10 == x) return v;
+        p10 *= 10;
+    }
+    return ~0ULL;
+}
+
+static vector<string> split_list(const string& s) {
+    vector<string> out;
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t comma = s.find(',', pos);
+        if (comma == string::npos) comma = s.size();
+        if (comma > pos) out.push_back(s.substr(pos, comma - pos));
+        pos = comma + 1;
+    }
+    return out;
+}
+
+// Value of "key" in one line of our own JSON output ("" if absent)
+static string json_field(const string& line, const string& key) {
+    size_t at = line.find("\"" + key + "\":");
+    if (at == string::npos) return "";
+    at += key.size() + 3;
+    bool quoted = at < line.size() && line[at] == '"';
+    if (quoted) ++at;
+    size_t end = line.find_first_of(quoted ? "\"" : ",}", at);
+    return line.substr(at, end == string::npos ? string::npos : end - at);
+}
+
+static int run_bench(int argc, char** argv, int i) {
+    vector<string> xs = {"1e9", "1e10"}, thread_list = {"1", "3"}, engines = {"odd", "wheel30", "wheel210"},
+                   segments = {"auto"};
+    int reps = 5;
+    const char* json_path = nullptr;
+    const char* baseline_path = nullptr;
+    double max_regress = 5.0;
+    for (; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << arg << "\n";
+            return 1;
+        }
+        if (arg == "--x") xs = split_list(argv[++i]);
+        else if (arg == "--threads") thread_list = split_list(argv[++i]);
+        else if (arg == "--engines") engines = split_list(argv[++i]);
+        else if (arg == "--segments") segments = split_list(argv[++i]);
+        else if (arg == "--reps") reps = max(1, atoi(argv[++i]));
+        else if (arg == "--json") json_path = argv[++i];
+        else if (arg == "--baseline") baseline_path = argv[++i];
+        else if (arg == "--max-regress") max_regress = atof(argv[++i]);
+        else {
+            cerr << "Unknown bench option '" << arg << "'\n";
+            return 1;
+        }
+    }
 
-            // Set all bits to 1 (all prime initially)
-            memset(flags.data(), 0xFF, WorkAllocator::SEG_U64S * sizeof(u64));
+    // Baseline primes/s by configuration key
+    map<string, double> baseline;
+    if (baseline_path) {
+        ifstream in(baseline_path);
+        if (!in) {
+            cerr << "Cannot read baseline '" << baseline_path << "'\n";
+            return 1;
+        }
+        for (string line; getline(in, line);) {
+            string rate = json_field(line, "primes_per_s");
+            if (rate.empty()) continue;
+            string key = json_field(line, "engine") + "/" + json_field(line, "segment") + "/" +
+                         json_field(line, "threads") + "/" + json_field(line, "x");
+            baseline[key] = atof(rate.c_str());
+        }
+    }
 
-            // Sieve - skip even prime (2)
-            size_t start_idx = 0;
-            if (!base_shared->primes.empty() && base_shared->primes[0] == 2) {
-                start_idx = 1;
+    // Everything is checked before the JSON file is opened, so a bad option
+    // leaves no empty report behind. Calibration is deferred to the run
+    vector<u64> bounds;
+    for (const string& xs_i : xs) {
+        u64 x;
+        if (!parse_u64(xs_i.c_str(), x)) {
+            cerr << "Bad bench bound '" << xs_i << "'\n";
+            return 1;
+        }
+        bounds.push_back(x);
+    }
+    CacheInfo caches = detect_caches();
+    auto candidates = [](const string& engine) {
+        vector<const EngineInfo*> cands;
+        for (const auto& e : ENGINES) if (engine == e.name) cands.push_back(&e);
+        return cands;
+    };
+    for (const string& engine : engines) {
+        vector<const EngineInfo*> cands = candidates(engine);
+        for (const string& segment : segments) {
+            if (cands.empty() || (segment != "calibrate" && !pick_geometry(cands, segment, caches, 0))) {
+                cerr << "Unknown engine or segment '" << engine << "' '" << segment << "'\n";
+                return 1;
             }
+        }
+    }
 
-            for (size_t bi = start_idx; bi < base_shared->primes.size(); ++bi) {
-                u32 p = base_shared->primes[bi];
-                u64 step = p * 2; // Step by 2p to stay odd
-                
-                // Get starting position for this segment
-                u64 j = next_mult[bi];
-                if (j < lo_odd) {
-                    // Recalculate if we're behind
-                    u64 m = ((lo_odd + p - 1) / p) * p;
-                    if ((m & 1) == 0) m += p;
-                    j = m;
-                }
-                
-                // Mark composites - unrolled by 4
-                u64 end = lo_odd + WorkAllocator::SEG_SPAN;
-                while (j + 3*step < end) {
-                    u64 idx0 = (j - lo_odd) >> 1;
-                    u64 idx1 = (j + step - lo_odd) >> 1;
-                    u64 idx2 = (j + 2*step - lo_odd) >> 1;
-                    u64 idx3 = (j + 3*step - lo_odd) >> 1;
-                    
-                    if (idx0 < WorkAllocator::SEG_BITS) clear_bit(flags.data(), idx0);
-                    if (idx1 < WorkAllocator::SEG_BITS) clear_bit(flags.data(), idx1);
-                    if (idx2 < WorkAllocator::SEG_BITS) clear_bit(flags.data(), idx2);
-                    if (idx3 < WorkAllocator::SEG_BITS) clear_bit(flags.data(), idx3);
-                    
-                    j += 4 * step;
-                }
-                
-                // Handle remainder
-                while (j < end) {
-                    u64 idx = (j - lo_odd) >> 1;
-                    if (idx < WorkAllocator::SEG_BITS) {
-                        clear_bit(flags.data(), idx);
+    FILE* json = json_path ? fopen(json_path, "w") : stdout;
+    if (!json) {
+        cerr << "Cannot write '" << json_path << "'\n";
+        return 1;
+    }
+
+    bool failed = false;
+    for (u64 x : bounds) {
+        for (const string& engine : engines) {
+            vector<const EngineInfo*> cands = candidates(engine);
+            for (const string& segment : segments) {
+                const EngineInfo* info = pick_geometry(cands, segment, caches, 0, &cout);
+                string seg_name = to_string(info->seg_bytes / 1024) + "k";
+                for (const string& ts : thread_list) {
+                    unsigned threads = (unsigned)max(1, atoi(ts.c_str()));
+                    count_range(info, 0, x, threads); // Warm-up: page faults, base primes, clocks
+
+                    vector<double> times;
+                    RangeResult run;
+                    bool ok = true;
+                    u64 want = known_pi(x);
+                    for (int r = 0; r < reps; ++r) {
+                        run = count_range(info, 0, x, threads);
+                        times.push_back(run.seconds);
+                        if (want != ~0ULL && run.primes != want) ok = false;
                     }
-                    j += step;
+                    sort(times.begin(), times.end());
+                    double median = times[times.size() / 2];
+                    if (times.size() % 2 == 0) median = (median + times[times.size() / 2 - 1]) / 2;
+                    double p95 = times[min(times.size() - 1, (size_t)ceil(0.95 * times.size()) - 1)];
+                    double primes_s = run.primes / median;
+                    double segs_s = run.segments / median;
+
+                    string key = engine + "/" + seg_name + "/" + to_string(threads) + "/" + to_string(x);
+                    double regress = 0.0;
+                    auto it = baseline.find(key);
+                    if (it != baseline.end() && it->second > 0) regress = 100.0 * (1.0 - primes_s / it->second);
+                    bool regressed = it != baseline.end() && regress > max_regress;
+                    failed |= !ok || regressed;
+
+                    fprintf(json, "{\"engine\":\"%s\",\"segment\":\"%s\",\"threads\":%u,\"x\":%llu,"
+                                  "\"pi\":%llu,\"pi_ok\":%s,\"reps\":%d,\"median_s\":%.6f,\"p95_s\":%.6f,"
+                                  "\"primes_per_s\":%.1f,\"segments_per_s\":%.1f",
+                            engine.c_str(), seg_name.c_str(), threads, (unsigned long long)x,
+                            (unsigned long long)run.primes, want == ~0ULL ? "null" : ok ? "true" : "false", reps,
+                            median, p95, primes_s, segs_s);
+                    if (it != baseline.end()) {
+                        fprintf(json, ",\"baseline_primes_per_s\":%.1f,\"regress_pct\":%.2f", it->second, regress);
+                    }
+                    fprintf(json, "}\n");
+                    fflush(json);
+                    if (!ok) cerr << "FAIL: pi(" << x << ") = " << run.primes << ", expected " << want << " (" << key << ")\n";
+                    if (regressed) cerr << "FAIL: " << key << " is " << regress << "% slower than the baseline\n";
                 }
-                
-                next_mult[bi] = j; // Save for next segment
             }
+        }
+    }
+    if (json != stdout) fclose(json);
+    return failed ? 1 : 0;
+}
 
-            // Count primes in this segment
-            u64 seg_count = popcount_array(flags.data(), WorkAllocator::SEG_U64S);
-            local_count += seg_count;
-
-            // ---- metrics for reality checks ----
-            ++local_segments;
-            local_bytes += WorkAllocator::SEG_BYTES;
-            if (hi > local_max_hi) local_max_hi = hi;
-
-            // Find largest prime in segment (scan backwards)
-            for (int64_t i = WorkAllocator::SEG_BITS - 1; i >= 0; --i) {
-                if (test_bit(flags.data(), i)) {
-                    u64 p = lo_odd + (i << 1);
-                    if (p > local_largest) {
-                        local_largest = p;
-                    }
-                    break; // Found largest in this segment
+// -------------------- Cluster mode --------------------
+// --serve PORT turns this process into the coordinator of a bounded range.
+// The range is cut into leases of --lease-span numbers, and every
+// --connect worker holds one lease at a time. A lease that is not back
+// within --lease-timeout seconds, or whose worker drops, is leased again;
+// the first result for it wins. Results fold in lease order, like chunks
+// in the ChunkTracker, so pairs and gaps across lease boundaries come out
+// exact and the exact pi() of the finished prefix is known all along.
+// Leases are plain number ranges, so every node may run its own engine
+// and geometry. A message is a u32 length, a type byte and LEB128 varints;
+// a result with its gap histogram is a few hundred bytes.
+enum ClusterMsg : u8 { MSG_HELLO = 1, MSG_LEASE = 2, MSG_RESULT = 3, MSG_DONE = 4 };
+static constexpr u64 CLUSTER_VERSION = 1;
+static constexpr u32 CLUSTER_MAX_FRAME = 1u << 20;
+
+static vector<u8> begin_msg(u8 type) {
+    vector<u8> m(4, 0);
+    m.push_back(type);
+    return m;
+}
+
+static bool send_msg(int fd, vector<u8>& m) {
+    u32 n = (u32)(m.size() - 4);
+    for (u32 k = 0; k < 4; ++k) m[k] = (u8)(n >> (8 * k));
+    for (size_t off = 0; off < m.size();) {
+        ssize_t w = send(fd, m.data() + off, m.size() - off, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        off += (size_t)w;
+    }
+    return true;
+}
+
+// Reads varints off a received message; ok turns false on a short one
+struct MsgReader {
+    const u8* p;
+    const u8* end;
+    bool ok = true;
+
+    u64 get() {
+        u64 v = 0;
+        for (u32 shift = 0; ok; shift += 7) {
+            if (p == end || shift > 63) break;
+            u8 b = *p++;
+            v |= (u64)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        ok = false;
+        return 0;
+    }
+};
+
+// Blocking read of one message body (type byte first)
+static bool recv_msg(int fd, vector<u8>& body) {
+    auto read_all = [&](u8* p, size_t n) {
+        while (n) {
+            ssize_t r = recv(fd, p, n, 0);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            p += r;
+            n -= (size_t)r;
+        }
+        return true;
+    };
+    u8 len[4];
+    if (!read_all(len, 4)) return false;
+    u32 n = (u32)len[0] | (u32)len[1] << 8 | (u32)len[2] << 16 | (u32)len[3] << 24;
+    if (n == 0 || n > CLUSTER_MAX_FRAME) return false;
+    body.resize(n);
+    return read_all(body.data(), n);
+}
+
+struct LeaseResult {
+    u64 primes = 0;
+    RangeStats rs;
+};
+
+static void put_result(vector<u8>& m, u64 lease, const LeaseResult& res, double seconds) {
+    const PrimeStats& st = res.rs.stats;
+    for (u64 v : {lease, res.primes, (u64)(seconds * 1e6), st.lo, st.hi, st.pairs[0], st.pairs[1], st.pairs[2],
+                  st.first, st.last, st.max_gap, st.max_gap_at, (u64)st.head, (u64)st.tail}) {
+        OutBlock::put_varint(m, v);
+    }
+    OutBlock::put_varint(m, st.records.size());
+    for (const auto& r : st.records) {
+        OutBlock::put_varint(m, r.gap);
+        OutBlock::put_varint(m, r.after);
+    }
+    u64 bins = 0;
+    for (u32 k = 0; k < GapHistogram::BINS; ++k) bins += res.rs.hist.count[k] != 0;
+    OutBlock::put_varint(m, bins);
+    for (u32 k = 0; k < GapHistogram::BINS; ++k) {
+        if (!res.rs.hist.count[k]) continue;
+        OutBlock::put_varint(m, k);
+        OutBlock::put_varint(m, res.rs.hist.count[k]);
+    }
+}
+
+static bool get_result(MsgReader& in, u64& lease, LeaseResult& res, double& seconds) {
+    PrimeStats& st = res.rs.stats;
+    lease = in.get();
+    res.primes = in.get();
+    seconds = in.get() / 1e6;
+    st.lo = in.get();
+    st.hi = in.get();
+    for (u32 g = 0; g < PrimeStats::NUM_GAPS; ++g) st.pairs[g] = in.get();
+    st.first = in.get();
+    st.last = in.get();
+    st.max_gap = in.get();
+    st.max_gap_at = in.get();
+    st.head = (u8)in.get();
+    st.tail = (u8)in.get();
+    u64 n = in.get();
+    for (u64 k = 0; k < n && in.ok; ++k) {
+        u64 gap = in.get();
+        st.records.push_back(GapRecord{gap, in.get()});
+    }
+    n = in.get();
+    for (u64 k = 0; k < n && in.ok; ++k) {
+        u64 bin = in.get();
+        u64 count = in.get();
+        if (bin >= GapHistogram::BINS) return false;
+        res.rs.hist.count[bin] = count;
+    }
+    return in.ok;
+}
+
+static int run_coordinator(const char* port, const RunLimits& limits, u64 span, double timeout,
+                           bool tuples, const char* gaps_path) {
+    using clock = chrono::steady_clock;
+    struct Lease {
+        u64 lo, hi;
+        int state = 0;          // 0 free, 1 leased, 2 done
+        u64 peer = 0;           // Id of the peer it was last leased to
+        clock::time_point due{};
+    };
+    struct Peer {
+        u64 id;
+        int fd;
+        string name;
+        vector<u8> in;
+        long lease = -1;        // Held lease, -1 when idle
+        bool hello = false;
+    };
+
+    vector<Lease> leases;
+    for (u64 a = limits.lo;;) {
+        u64 b = limits.hi - a < span ? limits.hi : a + span - 1;
+        leases.push_back(Lease{a, b});
+        if (b == limits.hi) break;
+        a = b + 1;
+    }
+
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(nullptr, port, &hints, &res) != 0 || !res) {
+        cerr << "Bad --serve port '" << port << "'\n";
+        return 1;
+    }
+    int lfd = socket(res->ai_family, SOCK_STREAM, 0);
+    int one = 1;
+    if (lfd >= 0) setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (lfd < 0 || bind(lfd, res->ai_addr, res->ai_addrlen) != 0 || listen(lfd, 16) != 0) {
+        cerr << "Cannot listen on port " << port << ": " << strerror(errno) << "\n";
+        freeaddrinfo(res);
+        return 1;
+    }
+    freeaddrinfo(res);
+    cout << "Coordinating [" << limits.lo << ", " << limits.hi << "] in " << leases.size() << " leases of "
+         << span << " on port " << port << "\n" << flush;
+
+    u8 flags = (tuples ? 1 : 0) | (gaps_path ? 2 : 0);
+    vector<Peer> peers;
+    vector<unique_ptr<LeaseResult>> results(leases.size());
+    size_t merged = 0;          // Leases [0, merged) are folded in
+    u64 primes = 0;
+    PrimeStats stats;
+    GapHistogram hist;
+    u64 releases = 0;
+    u64 peer_ids = 0;
+    auto t0 = clock::now();
+
+    auto give_lease = [&](Peer& p) {
+        size_t k = 0;
+        while (k < leases.size() && leases[k].state != 0) ++k;
+        if (k == leases.size()) return;
+        vector<u8> m = begin_msg(MSG_LEASE);
+        for (u64 v : {(u64)k, leases[k].lo, leases[k].hi, (u64)flags}) OutBlock::put_varint(m, v);
+        if (!send_msg(p.fd, m)) return;
+        leases[k].state = 1;
+        leases[k].peer = p.id;
+        leases[k].due = clock::now() + chrono::duration_cast<clock::duration>(chrono::duration<double>(timeout));
+        p.lease = (long)k;
+    };
+    auto drop = [&](size_t i) {
+        Peer& p = peers[i];
+        if (p.lease >= 0 && leases[p.lease].state == 1 && leases[p.lease].peer == p.id) leases[p.lease].state = 0;
+        cout << "Worker " << p.name << " left\n" << flush;
+        close(p.fd);
+        peers.erase(peers.begin() + i);
+    };
+    // One message from peer i; false drops it
+    auto handle = [&](Peer& p, const u8* body, size_t n) {
+        MsgReader in{body + 1, body + n};
+        if (body[0] == MSG_HELLO) {
+            u64 version = in.get();
+            u64 threads = in.get();
+            u64 name_len = in.get();
+            if (!in.ok || version != CLUSTER_VERSION || name_len > (u64)(in.end - in.p)) return false;
+            string engine((const char*)in.p, (size_t)name_len);
+            cout << "Worker " << p.name << " joined: " << threads << " threads, " << engine << "\n" << flush;
+            p.hello = true;
+            return true;
+        }
+        if (body[0] != MSG_RESULT || !p.hello) return false;
+        u64 k;
+        double seconds;
+        unique_ptr<LeaseResult> r(new LeaseResult);
+        if (!get_result(in, k, *r, seconds) || k >= leases.size()) return false;
+        if (p.lease == (long)k) p.lease = -1;
+        if (leases[k].state == 2) return true;      // Someone else was faster
+        leases[k].state = 2;
+        hist.merge(r->rs.hist);
+        results[k] = std::move(r);
+        while (merged < leases.size() && results[merged]) {
+            primes += results[merged]->primes;
+            stats.merge(results[merged]->rs.stats, gaps_path ? &hist : nullptr);
+            results[merged].reset();
+            ++merged;
+        }
+        cout << "Lease " << k << " [" << leases[k].lo << ", " << leases[k].hi << "] from " << p.name << " in "
+             << fixed << setprecision(2) << seconds << " s; " << merged << "/" << leases.size() << " folded";
+        if (merged) cout << ", " << primes << " primes in [" << limits.lo << ", " << leases[merged - 1].hi << "]";
+        cout << "\n" << flush;
+        return true;
+    };
+
+    while (merged < leases.size()) {
+        vector<pollfd> fds(1 + peers.size());
+        fds[0] = pollfd{lfd, POLLIN, 0};
+        for (size_t i = 0; i < peers.size(); ++i) fds[1 + i] = pollfd{peers[i].fd, POLLIN, 0};
+        if (poll(fds.data(), fds.size(), 1000) < 0 && errno != EINTR) {
+            cerr << "poll failed: " << strerror(errno) << "\n";
+            return 1;
+        }
+
+        for (size_t i = peers.size(); i-- > 0;) {
+            if (!(fds[1 + i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            Peer& p = peers[i];
+            u8 buf[65536];
+            ssize_t r = recv(p.fd, buf, sizeof(buf), 0);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) {
+                drop(i);
+                continue;
+            }
+            p.in.insert(p.in.end(), buf, buf + r);
+            bool ok = true;
+            size_t off = 0;
+            while (ok && p.in.size() - off >= 4) {
+                const u8* h = p.in.data() + off;
+                u32 n = (u32)h[0] | (u32)h[1] << 8 | (u32)h[2] << 16 | (u32)h[3] << 24;
+                if (n == 0 || n > CLUSTER_MAX_FRAME) ok = false;
+                else if (p.in.size() - off - 4 < n) break;
+                else {
+                    ok = handle(p, h + 4, n);
+                    off += 4 + n;
                 }
             }
-            
-            // Check deadline
-            if (clock::now() >= deadline) break;
+            p.in.erase(p.in.begin(), p.in.begin() + off);
+            if (!ok) {
+                cout << "Worker " << p.name << " sent a bad message\n";
+                drop(i);
+            }
         }
 
-        if (clock::now() >= deadline) break;
+        if (fds[0].revents & POLLIN) {
+            sockaddr_storage addr;
+            socklen_t len = sizeof(addr);
+            int fd = accept(lfd, (sockaddr*)&addr, &len);
+            if (fd >= 0) {
+                char host[NI_MAXHOST] = "?", serv[NI_MAXSERV] = "?";
+                getnameinfo((sockaddr*)&addr, len, host, sizeof(host), serv, sizeof(serv), NI_NUMERICHOST | NI_NUMERICSERV);
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                peers.push_back(Peer{++peer_ids, fd, string(host) + ":" + serv, {}});
+            }
+        }
+
+        // Overdue leases go back to the pool; the late worker may still win
+        auto now = clock::now();
+        for (size_t k = merged; k < leases.size(); ++k) {
+            if (leases[k].state == 1 && now > leases[k].due) {
+                leases[k].state = 0;
+                ++releases;
+                cout << "Lease " << k << " timed out, leasing it again\n" << flush;
+            }
+        }
+        for (auto& p : peers) {
+            if (p.hello && p.lease < 0) give_lease(p);
+        }
+    }
+
+    for (auto& p : peers) {
+        vector<u8> m = begin_msg(MSG_DONE);
+        send_msg(p.fd, m);
+        close(p.fd);
     }
+    close(lfd);
+    double seconds = chrono::duration<double>(clock::now() - t0).count();
 
-    out->primes_count = local_count;
-    out->largest_prime = local_largest;
-    out->segments_processed = local_segments;
-    out->bytes_touched = local_bytes;
-    out->max_hi_processed = local_max_hi;
+    cout << "Range: [" << limits.lo << ", " << limits.hi << "]\n";
+    cout << "Primes found: " << primes << "\n";
+    cout << "Leases: " << leases.size() << " (" << releases << " leased again after a timeout)\n";
+    if (tuples) {
+        cout << "Prime pairs: twin " << stats.pairs[0] << ", cousin " << stats.pairs[1] << ", sexy " << stats.pairs[2] << "\n";
+    }
+    if (tuples || gaps_path) cout << "Largest prime gap: " << stats.max_gap << " (after " << stats.max_gap_at << ")\n";
+    if (gaps_path) {
+        cout << "Gap histogram: " << hist.total() << " gaps, " << stats.records.size() << " maximal gaps\n";
+        if (!write_gaps(gaps_path, hist, stats.records)) {
+            cerr << "Failed to write '" << gaps_path << "'\n";
+            return 1;
+        }
+    }
+    cout << "Time: " << fixed << setprecision(3) << seconds << " s\n";
+    return 0;
+}
+
+// --connect HOST:PORT: sieve leases from a coordinator until it is done
+static int run_cluster_worker(const char* spec, const EngineInfo* info, unsigned threads) {
+    string s = spec;
+    size_t colon = s.rfind(':');
+    if (colon == string::npos) {
+        cerr << "Bad --connect '" << spec << "' (expected HOST:PORT)\n";
+        return 1;
+    }
+    string host = s.substr(0, colon), port = s.substr(colon + 1);
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res) {
+        cerr << "Cannot resolve '" << spec << "'\n";
+        return 1;
+    }
+    int fd = -1;
+    for (addrinfo* a = res; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        cerr << "Cannot connect to '" << spec << "': " << strerror(errno) << "\n";
+        return 1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    vector<u8> m = begin_msg(MSG_HELLO);
+    OutBlock::put_varint(m, CLUSTER_VERSION);
+    OutBlock::put_varint(m, threads);
+    OutBlock::put_varint(m, strlen(info->name));
+    m.insert(m.end(), info->name, info->name + strlen(info->name));
+    if (!send_msg(fd, m)) {
+        cerr << "Lost the coordinator\n";
+        return 1;
+    }
+
+    u64 leases = 0;
+    vector<u8> body;
+    for (;;) {
+        if (!recv_msg(fd, body)) {
+            cerr << "Lost the coordinator\n";
+            close(fd);
+            return 1;
+        }
+        if (body[0] == MSG_DONE) break;
+        MsgReader in{body.data() + 1, body.data() + body.size()};
+        u64 k = in.get(), lo = in.get(), hi = in.get(), flags = in.get();
+        if (body[0] != MSG_LEASE || !in.ok || lo > hi) {
+            cerr << "Bad message from the coordinator\n";
+            close(fd);
+            return 1;
+        }
+        LeaseResult r;
+        r.rs.pairs = flags & 1;
+        r.rs.gaps = (flags & 2) != 0;
+        RangeResult rr = count_range(info, lo, hi, threads, nullptr, nullptr, flags ? &r.rs : nullptr);
+        r.primes = rr.primes;
+        m = begin_msg(MSG_RESULT);
+        put_result(m, k, r, rr.seconds);
+        if (!send_msg(fd, m)) {
+            cerr << "Lost the coordinator\n";
+            close(fd);
+            return 1;
+        }
+        ++leases;
+        cout << "Lease " << k << " [" << lo << ", " << hi << "]: " << rr.primes << " primes in " << fixed
+             << setprecision(2) << rr.seconds << " s\n" << flush;
+    }
+    close(fd);
+    cout << "Coordinator done after " << leases << " leases here\n";
+    return 0;
 }
 
-// -------------------- main --------------------
 int main(int argc, char** argv) {
-    double RUN_SECONDS = 10.0;
-    if (argc >= 2) RUN_SECONDS = atof(argv[1]);
+    RunLimits limits;
 
     // Default to 3 threads for Pi Zero 2W (better memory bandwidth utilization)
     unsigned threads = 3;
     unsigned hw_threads = std::thread::hardware_concurrency();
     if (hw_threads > 0 && hw_threads < 3) threads = hw_threads;
-    
-    if (argc >= 3) {
-        int t = atoi(argv[2]);
-        if (t > 0) threads = (unsigned)t;
+
+    string engine = "odd";
+
+    // Segment geometry: auto (from cache sizes), calibrate, 16k, 32k, 128k or 512k
+    string segment = "auto";
+
+    // Chunk allocation: contiguous runs per thread, or one chunk at a time
+    string alloc_mode = "contiguous";
+
+    // Optional varint prime stream and segment bitmap archive
+    const char* output_path = nullptr;
+    const char* archive_path = nullptr;
+
+    // Periodic checkpoints, and the checkpoint to resume from
+    const char* checkpoint_path = nullptr;
+    double checkpoint_every = 60.0;
+    const char* resume_path = nullptr;
+    bool engine_given = false;
+
+    // Live progress sinks (led:NAME, gpio:N, status, udp:HOST:PORT)
+    const char* monitor_spec = nullptr;
+    double monitor_every = 60.0;
+    bool monitor_every_given = false;
+
+    // Temperature / frequency / power sampling on the monitor's ticks, and
+    // the governor that parks workers near the throttle point
+    bool thermal_on = false;
+    const char* thermal_log = nullptr;
+    const char* power_path = nullptr;
+    bool governor = false;
+    double throttle_temp = 0;
+
+    // Worker placement: one CPU each, and/or one core left to the OS
+    bool pin = false;
+    bool keep_core_free = false;
+    bool threads_given = false;
+
+    // Hardware counters per worker (SIEVE_PROFILE builds on Linux)
+    bool perf = false;
+
+    // Background cross-checks of sampled segments
+    bool verify = false;
+
+    // Twin / cousin / sexy pair counts and the largest gap
+    bool tuples = false;
+    const char* gaps_path = nullptr;
+
+    // Largest prime found once at the end, not per segment
+    bool stats_lite = false;
+
+    // Cluster roles: coordinator of a range, or a worker of one
+    const char* serve_port = nullptr;
+    const char* connect_spec = nullptr;
+    u64 lease_span = 10000000000ULL;
+    double lease_timeout = 600.0;
+    u64 verify_every = 64;
+
+    // Timed runs start here instead of 0
+    bool start_given = false;
+
+    vector<const char*> positional;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--engine" && i + 1 < argc) {
+            engine = argv[++i];
+            engine_given = true;
+        } else if (arg == "--segment" && i + 1 < argc) {
+            segment = argv[++i];
+        } else if (arg == "--alloc" && i + 1 < argc) {
+            alloc_mode = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (arg == "--archive" && i + 1 < argc) {
+            archive_path = argv[++i];
+        } else if (arg == "--monitor" && i + 1 < argc) {
+            monitor_spec = argv[++i];
+        } else if (arg == "--monitor-every" && i + 1 < argc) {
+            monitor_every = atof(argv[++i]);
+            monitor_every_given = true;
+        } else if (arg == "--thermal") {
+            thermal_on = true;
+        } else if (arg == "--thermal-log" && i + 1 < argc) {
+            thermal_on = true;
+            thermal_log = argv[++i];
+        } else if (arg == "--power" && i + 1 < argc) {
+            thermal_on = true;
+            power_path = argv[++i];
+        } else if (arg == "--governor") {
+            thermal_on = governor = true;
+        } else if (arg == "--throttle-temp" && i + 1 < argc) {
+            throttle_temp = atof(argv[++i]);
+            if (throttle_temp <= 0) {
+                cerr << "Bad --throttle-temp '" << argv[i] << "'\n";
+                return 1;
+            }
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serve_port = argv[++i];
+        } else if (arg == "--connect" && i + 1 < argc) {
+            connect_spec = argv[++i];
+        } else if (arg == "--lease-span" && i + 1 < argc) {
+            if (!parse_u64(argv[++i], lease_span) || lease_span == 0) {
+                cerr << "Bad --lease-span '" << argv[i] << "'\n";
+                return 1;
+            }
+        } else if (arg == "--lease-timeout" && i + 1 < argc) {
+            lease_timeout = atof(argv[++i]);
+        } else if (arg == "--stats-lite") {
+            stats_lite = true;
+        } else if (arg == "--tuples") {
+            tuples = true;
+        } else if (arg == "--gaps" && i + 1 < argc) {
+            gaps_path = argv[++i];
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg == "--verify-every" && i + 1 < argc) {
+            verify = true;
+            if (!parse_u64(argv[++i], verify_every) || verify_every == 0) {
+                cerr << "Bad --verify-every '" << argv[i] << "'\n";
+                return 1;
+            }
+        } else if (arg == "--perf") {
+#ifdef PRIME_SIEVE_HAVE_PERF_EVENTS
+            perf = true;
+#else
+            cerr << "--perf needs a Linux build with -DSIEVE_PROFILE\n";
+            return 1;
+#endif
+        } else if (arg == "--pin") {
+            pin = true;
+        } else if (arg == "--keep-core-free") {
+            keep_core_free = true;
+        } else if (arg == "--no-huge-pages") {
+            use_huge_pages = false;
+        } else if (arg == "--scalar") {
+            kernels = select_kernels(true);
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpoint_path = argv[++i];
+        } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+            checkpoint_every = atof(argv[++i]);
+        } else if (arg == "--resume" && i + 1 < argc) {
+            resume_path = argv[++i];
+        } else if (arg == "--query") {
+            return run_query(argc, argv, i + 1);
+        } else if (arg == "--bench") {
+            return run_bench(argc, argv, i + 1);
+        } else if (arg == "--start" && i + 1 < argc) {
+            start_given = true;
+            if (!parse_u64(argv[++i], limits.lo)) {
+                cerr << "Bad --start '" << argv[i] << "'\n";
+                return 1;
+            }
+        } else if (arg == "--range" && i + 2 < argc) {
+            limits.bounded = true;
+            if (!parse_u64(argv[i + 1], limits.lo) || !parse_u64(argv[i + 2], limits.hi)) {
+                cerr << "Bad --range bounds '" << argv[i + 1] << "' '" << argv[i + 2] << "'\n";
+                return 1;
+            }
+            i += 2;
+        } else if (arg == "--up-to" && i + 1 < argc) {
+            limits.bounded = true;
+            limits.lo = 0;
+            if (!parse_u64(argv[++i], limits.hi)) {
+                cerr << "Bad --up-to bound '" << argv[i] << "'\n";
+                return 1;
+            }
+        } else if (arg.rfind("--", 0) == 0) {
+            // A known option lands here only when its operands are missing
+            static const char* const WITH_VALUE[] = {
+                "--engine", "--segment", "--alloc", "--output", "--archive", "--monitor", "--monitor-every",
+                "--thermal-log", "--power", "--throttle-temp", "--serve", "--connect", "--lease-span",
+                "--lease-timeout", "--gaps", "--verify-every", "--checkpoint", "--checkpoint-every", "--resume",
+                "--start", "--range", "--up-to"};
+            bool known = false;
+            for (const char* o : WITH_VALUE) known |= arg == o;
+            if (known) cerr << "Missing value for " << arg << "\n";
+            else cerr << "Unknown option '" << arg << "'\n";
+            return 1;
+        } else {
+            positional.push_back(argv[i]);
+        }
+    }
+
+    // Resuming takes the engine and range from the checkpoint, before the
+    // positional arguments, whose meaning depends on whether it is bounded
+    Checkpoint resume;
+    if (resume_path) {
+        if (!resume.load(resume_path)) {
+            cerr << "Cannot read checkpoint '" << resume_path << "'\n";
+            return 1;
+        }
+        if (engine_given && engine != resume.engine) {
+            cerr << "Checkpoint was written by engine " << resume.engine << ", not " << engine << "\n";
+            return 1;
+        }
+        if (archive_path) {
+            cerr << "--archive cannot be combined with --resume\n";
+            return 1;
+        }
+        if (start_given) {
+            cerr << "--start cannot be combined with --resume\n";
+            return 1;
+        }
+        engine = resume.engine;
+        limits.bounded = resume.bounded;
+        limits.lo = resume.lo;
+        limits.hi = resume.bounded ? resume.hi : MAX_BOUND;
+        if (!checkpoint_path) checkpoint_path = resume_path;
+    }
+
+    if (start_given && limits.bounded) {
+        cerr << "--start is for timed runs; use --range A B for a bounded one\n";
+        return 1;
+    }
+    limits.hi = min(limits.hi, MAX_BOUND);
+
+    // Positional arguments: [seconds] [threads], or just [threads] in range mode
+    size_t pos = 0;
+    if (!limits.bounded && positional.size() > pos) limits.seconds = atof(positional[pos++]);
+    if (positional.size() > pos) {
+        int t = atoi(positional[pos]);
+        if (t > 0) {
+            threads = (unsigned)t;
+            threads_given = true;
+        }
+    }
+
+    CpuPlan cpu_plan;
+    if (pin || keep_core_free) {
+        if (!plan_cpus(keep_core_free, cpu_plan)) {
+            cerr << "CPU pinning is not supported on this system\n";
+            return 1;
+        }
+        if (!threads_given) threads = min<unsigned>(threads, (unsigned)cpu_plan.workers.size());
+    }
+
+    if (archive_path && !limits.bounded) {
+        cerr << "--archive needs a fixed bound (--range or --up-to)\n";
+        return 1;
+    }
+
+    if (limits.lo > limits.hi) {
+        if (limits.bounded) cerr << "Empty range [" << limits.lo << ", " << limits.hi << "]\n";
+        else cerr << "--start " << limits.lo << " is past the largest bound, " << MAX_BOUND << "\n";
+        return 1;
+    }
+
+    // 32-bit builds keep fewer base primes (see BasePrimes::MAX_ROOT)
+    if (isqrt(limits.bounded ? limits.hi : limits.lo) > BasePrimes::MAX_ROOT) {
+        cerr << "Bounds past " << (u64)BasePrimes::MAX_ROOT * BasePrimes::MAX_ROOT << " need a 64-bit build\n";
+        return 1;
+    }
+
+    // A resumed run keeps the checkpoint's chunk boundaries
+    vector<const EngineInfo*> candidates;
+    bool engine_known = false;
+    for (const auto& e : ENGINES) {
+        if (engine != e.name) continue;
+        engine_known = true;
+        if (!resume_path || resume.chunk_span == e.chunk_span) candidates.push_back(&e);
+    }
+    if (!engine_known) {
+        cerr << "Unknown engine '" << engine << "' (expected odd, wheel30 or wheel210)\n";
+        return 1;
+    }
+    if (candidates.empty()) {
+        cerr << "Checkpoint geometry does not match this build\n";
+        return 1;
+    }
+    CacheInfo caches = detect_caches();
+    // Calibrate where the sieving starts: a resumed run at its watermark
+    u64 calibrate_at = limits.lo;
+    if (resume_path) {
+        u64 c = limits.lo / resume.chunk_span + resume.watermark;
+        calibrate_at = c > limits.hi / resume.chunk_span ? limits.hi : c * resume.chunk_span;
+    }
+    const EngineInfo* info = pick_geometry(candidates, segment, caches, calibrate_at, &cout);
+    if (!info) {
+        cerr << "Unknown or unusable --segment '" << segment << "' (expected auto, calibrate, 16k, 32k, 128k or 512k)\n";
+        return 1;
     }
 
-    BasePrimes base_shared;
-    base_shared.ensure(100);
+    if (serve_port) {
+        if (!limits.bounded || resume_path) {
+            cerr << "--serve needs a fixed bound (--range or --up-to) and no --resume\n";
+            return 1;
+        }
+        return run_coordinator(serve_port, limits, lease_span, lease_timeout, tuples, gaps_path);
+    }
+    if (connect_spec) return run_cluster_worker(connect_spec, info, threads);
+
+    // Range mode knows its bound: size the base primes once, up front
+    BasePrimes base_shared(limits.bounded ? isqrt(limits.hi) : BasePrimes::MAX_ROOT);
+    base_shared.ensure(limits.bounded ? (u32)max<u64>(100, isqrt(limits.hi)) : 100);
+    if (resume_path) base_shared.ensure((u32)min<u64>(resume.base_bound, base_shared.max_root));
+    // A timed run from --start A needs primes to sqrt(A) before its first
+    // chunk; build them here rather than inside the timed window
+    if (start_given) {
+        u64 first_hi = limits.lo + min<u64>(info->chunk_span, MAX_BOUND - limits.lo);
+        base_shared.ensure((u32)min<u64>(max<u64>(100, isqrt(first_hi)), base_shared.max_root));
+    }
 
     WorkAllocator alloc;
+    if (alloc_mode == "interleaved") alloc.contiguous = false;
+    else if (alloc_mode != "contiguous") {
+        cerr << "Unknown alloc mode '" << alloc_mode << "' (expected contiguous or interleaved)\n";
+        return 1;
+    }
+    alloc.init(threads);
+    if (limits.bounded) {
+        alloc.total_chunks = limits.hi / info->chunk_span - limits.lo / info->chunk_span + 1;
+    }
+
+    ChunkTracker tracker;
+    u64 start_chunk = resume_path ? resume.watermark : 0;
+    tracker.init(threads, start_chunk, resume.primes_below, resume.largest_below);
+    GapHistogram boundary_gaps;
+    if (gaps_path) tracker.boundary_gaps = &boundary_gaps;
+    alloc.next_chunk.store(start_chunk, std::memory_order_relaxed);
+
+    // First number of the chunk `rel` chunks past lo's, and hi + 1 for any
+    // chunk ending past hi (the top chunk's own start + span can pass 2^64)
+    auto chunk_start = [&](u64 rel) {
+        u64 c = limits.lo / info->chunk_span + rel;
+        return c > limits.hi / info->chunk_span ? limits.hi + 1 : c * info->chunk_span;
+    };
+    u64 start_number = start_chunk ? chunk_start(start_chunk) : limits.lo;
+
+    // Everything that can fail opens before the first helper thread starts:
+    // an early return must not leave a joinable thread behind
+    Monitor monitor;
+    if (monitor_spec && !monitor.open(monitor_spec)) {
+        cerr << "Cannot open monitor sink '" << monitor_spec << "'\n";
+        return 1;
+    }
+    Thermal thermal;
+    if (thermal_on) {
+        if (const char* bad = thermal.open(power_path, thermal_log, throttle_temp)) {
+            bool power = strcmp(bad, "--power") == 0;
+            cerr << "Cannot " << (power ? "read " : "write ") << bad << " '" << (power ? power_path : thermal_log) << "'\n";
+            return 1;
+        }
+        monitor.thermal = &thermal;
+    }
+
+    PrimeArchive archive;
+    if (archive_path) {
+        vector<u64> lead;
+        for (u32 k = 0; k < info->wheel_primes; ++k) {
+            u32 p = SMALL_PRIMES[k];
+            if (p >= limits.lo && p <= limits.hi) lead.push_back(p);
+        }
+        if (!(archive.*info->create_archive)(archive_path, limits.lo, limits.hi, lead)) {
+            cerr << "Cannot create archive '" << archive_path << "'\n";
+            return 1;
+        }
+    }
+
+    // The writer emits chunks in order; long per-thread runs would leave
+    // every other thread waiting on the first one's ring
+    PrimeWriter writer;
+    if (output_path) {
+        if (alloc.contiguous) {
+            cerr << "Note: --output uses interleaved allocation\n";
+            alloc.contiguous = false;
+            alloc_mode = "interleaved";
+        }
+        vector<u64> lead;
+        for (u32 k = 1; k < info->wheel_primes; ++k) {
+            u32 p = SMALL_PRIMES[k];
+            if (p >= start_number && p <= limits.hi) lead.push_back(p);
+        }
+        bool has_two = start_number <= 2 && limits.hi >= 2;
+        if (!writer.open(output_path, start_number, start_chunk, has_two, lead, threads)) {
+            cerr << "Cannot open output file '" << output_path << "'\n";
+            return 1;
+        }
+    }
+
+    RunContext ctx;
+    ctx.limits = limits;
+    ctx.base = &base_shared;
+    ctx.alloc = &alloc;
+    ctx.writer = output_path ? &writer : nullptr;
+    ctx.archive = archive_path ? &archive : nullptr;
+    ctx.tracker = &tracker;
+    ctx.perf = perf;
+    ctx.tuples = tuples;
+    ctx.lite = stats_lite;
+    ctx.gaps = gaps_path != nullptr;
+    std::atomic<unsigned> active_threads{threads};
+    if (governor) ctx.active = &active_threads;
+
+    // --verify starts with this engine's pi(10^k) against the table, then
+    // samples the real run in the background
+    Verifier verifier;
+    bool verify_failed = false;
+    string verify_table;
+    if (verify) {
+        u64 x = 10;
+        for (int k = 1; k <= 8; ++k, x *= 10) {
+            u64 got = count_range(info, 0, x, 1).primes;
+            if (got != KNOWN_PI[k]) {
+                cerr << "Verify: pi(1e" << k << ") = " << got << ", expected " << KNOWN_PI[k] << "\n";
+                verify_failed = true;
+            }
+        }
+        verify_table = verify_failed ? "FAILED" : "ok";
+        verifier.every = verify_every;
+        verifier.start();
+        ctx.verifier = &verifier;
+    }
+
+    // Checkpoints are written off the hot path by their own thread
+    auto write_checkpoint = [&] {
+        Checkpoint c;
+        c.engine = engine;
+        c.bounded = limits.bounded;
+        c.lo = limits.lo;
+        c.hi = limits.bounded ? limits.hi : 0;
+        c.chunk_span = info->chunk_span;
+        tracker.advance(true);
+        tracker.snapshot(c.watermark, c.primes_below, c.largest_below);
+        c.base_bound = base_shared.snapshot()->sieved_to;
+        if (!c.save(checkpoint_path)) cerr << "Warning: cannot write checkpoint '" << checkpoint_path << "'\n";
+    };
+    mutex ckpt_mtx;
+    condition_variable ckpt_cv;
+    bool ckpt_stop = false;
+    thread ckpt_thread;
+    if (checkpoint_path) {
+        ckpt_thread = thread([&] {
+            unique_lock<mutex> lk(ckpt_mtx);
+            while (!ckpt_cv.wait_for(lk, chrono::duration<double>(checkpoint_every), [&] { return ckpt_stop; })) {
+                write_checkpoint();
+            }
+        });
+    }
 
     vector<thread> pool;
     vector<ThreadResult> results(threads);
 
+    if (thermal_on && governor) {
+        thermal.active = &active_threads;
+        thermal.max_threads = thermal.min_threads = threads;
+    }
+    if (monitor_spec || thermal_on) {
+        // Thermal sampling alone defaults to a finer tick
+        double every = monitor_every_given || !thermal_on ? monitor_every : 5.0;
+        monitor.every = every > 0 ? every : 60.0;
+        monitor.start(results.data(), results.size());
+    }
+
+    // The helper threads share the kept-free core with the OS
+    if (!cpu_plan.reserved.empty()) {
+        for (thread* th : {&writer.th, &ckpt_thread, &monitor.th, &verifier.th}) {
+            if (th->joinable()) pin_thread(th->native_handle(), cpu_plan.reserved);
+        }
+    }
+    atomic<bool> pin_failed{false};
+
     auto start_time = chrono::steady_clock::now();
     
     for (unsigned i = 0; i < threads; ++i) {
-        pool.emplace_back(worker, RUN_SECONDS, &base_shared, &alloc, &results[i]);
+        pool.emplace_back([&, i] {
+            if (!cpu_plan.workers.empty()) {
+                const vector<int>& w = cpu_plan.workers;
+                bool ok = pin ? pin_thread(pthread_self(), {w[i % w.size()]}) : pin_thread(pthread_self(), w);
+                if (!ok) pin_failed = true;
+            }
+            info->fn(&ctx, i, &results[i]);
+        });
     }
     for (auto& th : pool) th.join();
-    
+    // Time covers the sieve; verifying and output teardown come after it
     auto end_time = chrono::steady_clock::now();
     double actual_seconds = chrono::duration<double>(end_time - start_time).count();
+    monitor.stop();
+    verifier.stop();
+    double verify_stop = chrono::duration<double>(chrono::steady_clock::now() - end_time).count();
+    if (checkpoint_path) {
+        {
+            lock_guard<mutex> lk(ckpt_mtx);
+            ckpt_stop = true;
+        }
+        ckpt_cv.notify_all();
+        ckpt_thread.join();
+        write_checkpoint();
+    }
+    writer.close();
+    if (archive_path) {
+        archive.finish();
+        archive.close();
+    }
 
-    // Reduce results
-    u64 total = 0;
-    u64 maxp = 0;
-    for (const auto& r : results) {
-        total += r.primes_count;
-        if (r.largest_prime > maxp) maxp = r.largest_prime;
+    // Ordered reduction: the exact count covers the completed chunk prefix
+    // [lo, prefix_end); anything sieved past it is reported on its own
+    tracker.advance(true);
+    u64 watermark, total, maxp;
+    tracker.snapshot(watermark, total, maxp);
+    u64 prefix_end = chunk_start(watermark);
+    prefix_end = max(prefix_end, limits.lo);
+
+    u64 sieved = resume.primes_below;
+    for (const auto& r : results) sieved += r.primes_count;
+    u64 beyond_primes = sieved - total;
+
+    // The primes dividing the wheel modulus are not in the bitmap
+    for (u32 k = 0; k < info->wheel_primes; ++k) {
+        u32 p = SMALL_PRIMES[k];
+        if (p < limits.lo || p >= prefix_end) continue;
+        ++total;
+        if (p > maxp) maxp = p;
     }
+    if (stats_lite && prefix_end > limits.lo) maxp = largest_prime(info, limits.lo, prefix_end - 1);
+
     // Aggregate instrumentation
     u64 total_segments = 0;
     u64 total_bytes = 0;
-    u64 final_N_processed = 0;
+    u64 max_hi_touched = 0;
     for (const auto& r : results) {
         total_segments += r.segments_processed;
         total_bytes += r.bytes_touched;
-        if (r.max_hi_processed > final_N_processed) final_N_processed = r.max_hi_processed;
+        if (r.max_hi_processed > max_hi_touched) max_hi_touched = r.max_hi_processed;
     }
+    u64 beyond_segments = total_segments - tracker.segments_below;
 
+    cout << "Engine: " << engine << "\n";
+    cout << "Segment: " << info->seg_bytes / 1024 << "KB x " << info->chunk_segs << " per chunk";
+    if (info->sub_bytes < info->seg_bytes) cout << ", " << info->sub_bytes / 1024 << "KB sub-segments";
+    cout << " ("
+         << segment << "; L1d " << caches.l1d / 1024 << "KB, L2 " << caches.l2 / 1024 << "KB)\n";
+    cout << "Allocation: " << alloc_mode << "\n";
+    cout << "Kernels: " << kernels.name << "\n";
+    cout << "Arenas: " << arena_bytes / (1 << 20) << "MB reserved, " << arena_hugetlb_bytes / (1 << 20)
+         << "MB hugetlb, " << arena_thp_bytes / (1 << 20) << "MB THP-advised\n";
     cout << "Threads: " << threads << "\n";
+    if (pin || keep_core_free) {
+        cout << "Placement: " << (pin ? "pinned" : "floating");
+        if (!cpu_plan.reserved.empty()) {
+            cout << ", kept free cpu";
+            for (int c : cpu_plan.reserved) cout << " " << c;
+        } else if (keep_core_free) {
+            cout << ", no core to spare";
+        }
+        if (pin_failed) cout << " (setting the affinity failed)";
+        cout << "\n";
+    }
+    u64 migrations = 0;
+    cout << "Worker CPUs:";
+    for (const auto& r : results) {
+        cout << " " << r.cpu;
+        migrations += r.migrations;
+    }
+    cout << " (" << migrations << " migrations between chunks)\n";
+    u64 steals = 0;
+    cout << "Idle s/thread:";
+    for (const auto& r : results) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), " %.2f", r.waited + r.parked + max(0.0, actual_seconds - r.seconds));
+        cout << buf;
+        steals += r.steals;
+    }
+    cout << " (" << steals << " runs stolen)\n";
+    if (limits.bounded) {
+        cout << "Range: [" << limits.lo << ", " << limits.hi << "]\n";
+    } else if (limits.lo) {
+        cout << "Start: " << limits.lo << "\n";
+    }
+    if (resume_path) {
+        cout << "Resumed at: " << start_number << " (chunk " << start_chunk << ")\n";
+    }
     cout << "Primes found: " << total << "\n";
     cout << "Largest prime found: " << maxp << "\n";
-    cout << "Final N processed: " << final_N_processed << "\n";
+    if (prefix_end > limits.lo) {
+        cout << "Final N processed: " << prefix_end - 1 << "\n";
+    } else {
+        cout << "Final N processed: none (no chunk completed)\n";
+    }
+    if ((tuples || gaps_path) && prefix_end > start_number) {
+        PrimeStats st = tracker.stats_snapshot();
+        GapHistogram hist = boundary_gaps;
+        vector<u64> wheel;
+        for (u32 k = 0; k < info->wheel_primes; ++k) {
+            if (SMALL_PRIMES[k] >= start_number && SMALL_PRIMES[k] < prefix_end) wheel.push_back(SMALL_PRIMES[k]);
+        }
+        add_wheel_primes(st, wheel, start_number, prefix_end, &hist);
+        if (tuples) {
+            cout << "Prime pairs in [" << start_number << ", " << prefix_end - 1 << "]: twin " << st.pairs[0]
+                 << ", cousin " << st.pairs[1] << ", sexy " << st.pairs[2] << "\n";
+        }
+        cout << "Largest prime gap: " << st.max_gap << " (after " << st.max_gap_at << ")\n";
+        if (gaps_path) {
+            for (const auto& r : results) hist.merge(r.gaps);
+            u32 common = 0;
+            for (u32 k = 1; k < GapHistogram::BINS; ++k) {
+                if (hist.count[k] > hist.count[common]) common = k;
+            }
+            cout << "Gap histogram: " << hist.total() << " gaps, most often " << (common ? 2 * common : 1) << ", "
+                 << st.records.size() << " maximal gaps";
+            if (beyond_segments) cout << " (counts include chunks finished past N)";
+            cout << "\n";
+            if (!write_gaps(gaps_path, hist, st.records)) {
+                cerr << "Failed to write '" << gaps_path << "'\n";
+                return 1;
+            }
+        }
+    }
+    if (beyond_segments) {
+        cout << "Beyond N: " << beyond_primes << " primes in " << beyond_segments
+             << " segments of unfinished chunks, up to " << max_hi_touched - 1 << "\n";
+    }
     cout << "Segments processed: " << total_segments << "\n";
     cout << "Approx bytes touched: " << total_bytes << "\n";
     cout << "Time: " << fixed << setprecision(3) << actual_seconds << " s\n";
-    
-    return 0;
-}
\ No newline at end of file
+    if (thermal_on) {
+        thermal.report(total);
+        thermal.close();
+        if (governor) {
+            double parked = 0;
+            for (const auto& r : results) parked += r.parked;
+            cout << "Governor: " << thermal.changes << " changes, down to " << thermal.min_threads << " of "
+                 << threads << " threads, " << fixed << setprecision(1) << parked << " thread-s parked\n";
+        }
+    }
+#ifdef SIEVE_PROFILE
+    {
+        u64 ticks[NUM_PHASES] = {};
+        u64 all = 0;
+        for (const auto& r : results) {
+            for (int p = 0; p < NUM_PHASES; ++p) ticks[p] += r.phases.ticks[p];
+        }
+        for (u64 t : ticks) all += t;
+        double hz;
+        const char* unit = tick_unit(hz);
+        cout << "Profile (" << unit << ", all threads):\n";
+        for (int p = 0; p < NUM_PHASES; ++p) {
+            double per_seg = total_segments ? (double)ticks[p] / total_segments : 0.0;
+            cout << "  " << left << setw(7) << PHASE_NAMES[p] << right << setw(16) << ticks[p]
+                 << setw(7) << setprecision(1) << (all ? 100.0 * ticks[p] / all : 0.0) << "%"
+                 << setw(12) << setprecision(0) << per_seg << " per segment";
+            if (hz > 0) cout << " (" << setprecision(2) << per_seg / hz * 1e6 << " us)";
+            cout << "\n";
+        }
+    }
+#endif
+    if (perf) {
+        cout << "Perf counters (per segment):\n";
+        for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+            u64 sum = 0;
+            bool ok = true;
+            for (const auto& r : results) {
+                if (r.perf[e] == ~0ULL) ok = false;
+                else sum += r.perf[e];
+            }
+            cout << "  " << PERF_NAMES[e] << ": ";
+            if (ok && total_segments) cout << setprecision(1) << (double)sum / total_segments << "\n";
+            else cout << "unavailable\n";
+        }
+    }
+    if (output_path) {
+        cout << "Output: " << output_path << " (" << writer.primes_written << " primes up to "
+             << (writer.covered_end ? writer.covered_end - 1 : 0) << ", " << writer.bytes_written
+             << " bytes, " << setprecision(2)
+             << (writer.primes_written ? (double)writer.bytes_written / writer.primes_written : 0.0)
+             << " bytes/prime";
+        if (writer.blocks_dropped) cout << ", " << writer.blocks_dropped << " chunks past the ordered prefix dropped";
+        cout << ")\n";
+    }
+    if (archive_path) {
+        cout << "Archive: " << archive_path << " (" << archive.bytes << " bytes)\n";
+    }
+    if (verify) {
+        // An exact prefix [0, 10^k) is checked against the table as well
+        string prefix_check = "";
+        if (limits.lo == 0 && known_pi(prefix_end - 1) != ~0ULL) {
+            bool ok = known_pi(prefix_end - 1) == total;
+            prefix_check = string(", pi(") + to_string(prefix_end - 1) + ") " + (ok ? "ok" : "FAILED");
+            if (!ok) verify_failed = true;
+        }
+        if (verifier.count_mismatches || verifier.composites) verify_failed = true;
+        cout << "Verify: pi(10^k) k<=8 " << verify_table << prefix_check << ", " << verifier.segments_checked
+             << " segments recounted (" << verifier.count_mismatches << " mismatches), "
+             << verifier.primes_tested << " primes Miller-Rabin tested (" << verifier.composites
+             << " composite)";
+        if (verifier.above_recount) cout << ", " << verifier.above_recount << " segments past 1e14 not recounted";
+        cout << "\n";
+        cout << "Verify time: " << fixed << setprecision(3) << verifier.busy_seconds << " s checking, "
+             << verify_stop << " s stopping after the sieve, " << verifier.dropped << " samples dropped\n";
+    }
+
+    return verify_failed ? 1 : 0;
+}
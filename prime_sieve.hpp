@@ -0,0 +1,3057 @@
+// prime_sieve.hpp
+// The segmented sieve engines behind optimized_mc_pi, header-only so other
+// programs can use them in-process (see "Library API" at the end):
+//   #include "prime_sieve.hpp"
+//   prime_sieve::PrimeSieve ps("wheel30");
+//   u64 n = ps.count_primes(0, 1000000000, 4);
+//   for (auto it = ps.begin(1000000); *it < 1001000; ++it) use(*it);
+//   ps.for_each_prime_segment(lo, hi, [](const prime_sieve::SegmentView& s) { ... });
+// Build flags as for optimized_mc_pi (-O3 -pthread, -march/-mcpu for the
+// SIMD kernels, optional -DSIEVE_PROFILE).
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PRIME_SIEVE_HAVE_X86_KERNELS 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PRIME_SIEVE_HAVE_NEON_KERNELS 1
+#endif
+#if defined(SIEVE_PROFILE) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define PRIME_SIEVE_HAVE_PERF_EVENTS 1
+#endif
+
+namespace prime_sieve {
+
+
+using u8  = uint8_t;
+using u16 = uint16_t;
+using u32 = uint32_t;
+using u64 = uint64_t;
+
+// -------------------- Bit manipulation --------------------
+inline void clear_bit(u64* arr, size_t bit) {
+    arr[bit >> 6] &= ~(1ULL << (bit & 63));
+}
+
+inline bool test_bit(const u64* arr, size_t bit) {
+    return (arr[bit >> 6] >> (bit & 63)) & 1;
+}
+
+// Clear bits [from, to)
+inline void clear_bits(u64* arr, size_t from, size_t to) {
+    for (; from < to && (from & 63); ++from) clear_bit(arr, from);
+    for (; from + 64 <= to; from += 64) arr[from >> 6] = 0;
+    for (; from < to; ++from) clear_bit(arr, from);
+}
+
+// -------------------- SIMD kernels --------------------
+// Per-segment scans over the bitmap: popcount and "highest set bit" (the
+// largest prime). NEON is a compile-time choice (always present on AArch64,
+// -mfpu=neon on ARMv7). On x86 the AVX2 and AVX-512 VPOPCNTDQ versions are
+// built with target attributes and picked by CPU-feature dispatch, so one
+// binary runs well on any cluster node. Segment initialisation is a memcpy
+// of the pre-sieve pattern, which libc already does with the widest vectors.
+
+// Fast bit counting - portable version
+inline u64 popcount_scalar(const u64* arr, size_t n_u64) {
+    u64 total = 0;
+    
+    // Unroll by 4 for better performance
+    size_t i = 0;
+    for (; i + 3 < n_u64; i += 4) {
+        total += __builtin_popcountll(arr[i]);
+        total += __builtin_popcountll(arr[i + 1]);
+        total += __builtin_popcountll(arr[i + 2]);
+        total += __builtin_popcountll(arr[i + 3]);
+    }
+    
+    // Handle remainder
+    for (; i < n_u64; ++i) {
+        total += __builtin_popcountll(arr[i]);
+    }
+    
+    return total;
+}
+
+// Index of the highest set bit, or -1 if none
+inline int64_t last_set_scalar(const u64* arr, size_t n_u64) {
+    for (size_t w = n_u64; w-- > 0; ) {
+        if (arr[w]) return (int64_t)(w * 64 + 63 - __builtin_clzll(arr[w]));
+    }
+    return -1;
+}
+
+#ifdef PRIME_SIEVE_HAVE_NEON_KERNELS
+// vcnt per byte, pairwise-widened into u16 lanes (at most 64 per lane per
+// 64-byte block, so 512 blocks fit) and then into the u64 total
+inline u64 popcount_neon(const u64* arr, size_t n_u64) {
+    const u8* p = reinterpret_cast<const u8*>(arr);
+    size_t blocks = n_u64 / 8;
+    uint64x2_t total = vdupq_n_u64(0);
+    size_t b = 0;
+    while (b < blocks) {
+        size_t end = std::min(blocks, b + 512);
+        uint16x8_t acc = vdupq_n_u16(0);
+        for (; b < end; ++b, p += 64) {
+            uint8x16_t c0 = vcntq_u8(vld1q_u8(p));
+            uint8x16_t c1 = vcntq_u8(vld1q_u8(p + 16));
+            uint8x16_t c2 = vcntq_u8(vld1q_u8(p + 32));
+            uint8x16_t c3 = vcntq_u8(vld1q_u8(p + 48));
+            acc = vpadalq_u8(acc, vaddq_u8(vaddq_u8(c0, c1), vaddq_u8(c2, c3)));
+        }
+        total = vpadalq_u32(total, vpaddlq_u16(acc));
+    }
+    u64 sum = vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+    return sum + popcount_scalar(arr + blocks * 8, n_u64 - blocks * 8);
+}
+
+inline int64_t last_set_neon(const u64* arr, size_t n_u64) {
+    size_t w = n_u64;
+    for (; w >= 4; w -= 4) {
+        uint64x2_t a = vld1q_u64(arr + w - 4);
+        uint64x2_t b = vld1q_u64(arr + w - 2);
+        uint64x2_t o = vorrq_u64(a, b);
+        if (vgetq_lane_u64(o, 0) | vgetq_lane_u64(o, 1)) break;
+    }
+    return last_set_scalar(arr, w);
+}
+#endif
+
+#ifdef PRIME_SIEVE_HAVE_X86_KERNELS
+// Nibble lookup with vpshufb, summed per u64 lane with vpsadbw
+__attribute__((target("avx2")))
+inline u64 popcount_avx2(const u64* arr, size_t n_u64) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n_u64; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(arr + i));
+        __m256i lo = _mm256_and_si256(v, low);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    u64 sum = (u64)_mm256_extract_epi64(acc, 0) + (u64)_mm256_extract_epi64(acc, 1)
+            + (u64)_mm256_extract_epi64(acc, 2) + (u64)_mm256_extract_epi64(acc, 3);
+    return sum + popcount_scalar(arr + i, n_u64 - i);
+}
+
+__attribute__((target("avx2")))
+inline int64_t last_set_avx2(const u64* arr, size_t n_u64) {
+    size_t w = n_u64;
+    for (; w >= 4; w -= 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(arr + w - 4));
+        if (!_mm256_testz_si256(v, v)) break;
+    }
+    return last_set_scalar(arr, w);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+inline u64 popcount_avx512(const u64* arr, size_t n_u64) {
+    __m512i acc = _mm512_set1_epi64(0);
+    size_t i = 0;
+    for (; i + 8 <= n_u64; i += 8) {
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_loadu_si512(arr + i)));
+    }
+    u64 lanes[8];
+    _mm512_storeu_si512(lanes, acc);
+    u64 sum = 0;
+    for (u64 l : lanes) sum += l;
+    return sum + popcount_scalar(arr + i, n_u64 - i);
+}
+#endif
+
+struct Kernels {
+    const char* name;
+    u64 (*popcount)(const u64*, size_t);
+    int64_t (*last_set)(const u64*, size_t);
+};
+
+inline Kernels select_kernels(bool force_scalar) {
+    if (force_scalar) return {"scalar", popcount_scalar, last_set_scalar};
+#ifdef PRIME_SIEVE_HAVE_NEON_KERNELS
+    return {"neon", popcount_neon, last_set_neon};
+#endif
+#ifdef PRIME_SIEVE_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vpopcntdq") && __builtin_cpu_supports("avx2")) {
+        return {"avx512-vpopcntdq", popcount_avx512, last_set_avx2};
+    }
+    if (__builtin_cpu_supports("avx2")) return {"avx2", popcount_avx2, last_set_avx2};
+#endif
+    return {"scalar", popcount_scalar, last_set_scalar};
+}
+
+inline Kernels kernels = select_kernels(false);
+
+inline u64 popcount_array(const u64* arr, size_t n_u64) {
+    return kernels.popcount(arr, n_u64);
+}
+
+// -------------------- Memory arenas --------------------
+// Large long-lived buffers (base primes, each worker's multiples and
+// bitmap, bucket blocks) are mmap'd once at their final capacity, so they
+// never move or reallocate while a run is going. Regions of a huge page
+// or more ask for huge pages: MAP_HUGETLB when the system has a pool, else
+// an madvise(MADV_HUGEPAGE) hint for transparent huge pages. Pages are
+// backed when first written, and Linux puts each on the NUMA node of the
+// thread that first touches it; per-thread buffers are created and
+// cleared by their own worker, so they land on that worker's node.
+inline bool use_huge_pages = true;                  // --no-huge-pages
+inline std::atomic<u64> arena_bytes{0};             // Reserved address space, all kinds
+inline std::atomic<u64> arena_hugetlb_bytes{0};     // ... from the hugetlb pool
+inline std::atomic<u64> arena_thp_bytes{0};         // ... advised for THP
+
+struct Region {
+    static constexpr size_t HUGE_PAGE = 2u << 20;
+
+    void* base = nullptr;
+    size_t bytes = 0;
+
+    Region() = default;
+    Region(const Region&) = delete;
+    Region& operator=(const Region&) = delete;
+    Region(Region&& o) noexcept : base(o.base), bytes(o.bytes) { o.base = nullptr; o.bytes = 0; }
+    ~Region() { release(); }
+
+    // dense: the whole region will be used, so taking hugetlb pages
+    // (reserved up front) for all of it is not a waste
+    bool map(size_t n, bool dense) {
+        release();
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        bool huge = use_huge_pages && n >= HUGE_PAGE;
+        bytes = huge ? (n + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE : (n + page - 1) / page * page;
+        void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (huge && dense) {
+            p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) arena_hugetlb_bytes += bytes;
+        }
+#endif
+        if (p == MAP_FAILED) {
+            p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (p == MAP_FAILED) {
+                bytes = 0;
+                return false;
+            }
+#ifdef MADV_HUGEPAGE
+            if (huge && madvise(p, bytes, MADV_HUGEPAGE) == 0) arena_thp_bytes += bytes;
+#endif
+        }
+        base = p;
+        arena_bytes += bytes;
+        return true;
+    }
+
+    void release() {
+        if (base) munmap(base, bytes);
+        base = nullptr;
+        bytes = 0;
+    }
+};
+
+// A growable array of trivially copyable T inside one Region: capacity is
+// fixed by reserve(), and running past it is a bug, not a reallocation
+template <class T>
+struct FixedArray {
+    Region region;
+    T* items = nullptr;
+    size_t count = 0;
+    size_t cap = 0;
+
+    bool reserve(size_t n, bool dense) {
+        if (!region.map(std::max<size_t>(n, 1) * sizeof(T), dense)) return false;
+        items = static_cast<T*>(region.base);
+        count = 0;
+        cap = region.bytes / sizeof(T);
+        return true;
+    }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return cap; }
+    T* data() { return items; }
+    const T* data() const { return items; }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+    T* begin() { return items; }
+    T* end() { return items + count; }
+    void clear() { count = 0; }
+
+    void push_back(const T& v) {
+        if (count == cap) overflow();
+        items[count++] = v;
+    }
+    void resize(size_t n, const T& fill = T()) {
+        if (n > cap) overflow();
+        for (size_t i = count; i < n; ++i) items[i] = fill;
+        count = n;
+    }
+
+    [[noreturn]] static void overflow() {
+        fprintf(stderr, "FixedArray: capacity exceeded\n");
+        abort();
+    }
+};
+
+// Upper bound on pi(x) (Rosser and Schoenfeld), for sizing arenas
+inline size_t prime_count_bound(u64 x) {
+    if (x < 17) return 8;
+    return (size_t)(1.25506 * (double)x / log((double)x)) + 16;
+}
+
+// -------------------- Shared base primes --------------------
+// Workers read an immutable Snapshot through an atomic pointer, so the hot
+// loop never takes the mutex and never sees a vector mid-reallocation.
+// Growth, serialised by the mutex, sieves only (sieved_to, target] and
+// publishes a new snapshot holding the old primes plus the new ones.
+// The primes live in one FixedArray reserved up front for every prime up
+// to max_root, and a snapshot is just a count of them: growth appends past
+// the published count, so nothing is ever copied or moved. Replaced
+// snapshots stay alive until the BasePrimes goes away.
+struct BasePrimes {
+    // The first n primes; they never move
+    struct PrimeList {
+        const u32* p = nullptr;
+        size_t n = 0;
+
+        size_t size() const { return n; }
+        u32 operator[](size_t i) const { return p[i]; }
+        const u32* begin() const { return p; }
+        const u32* end() const { return p + n; }
+    };
+
+    struct Snapshot {
+        PrimeList primes;
+        u32 sieved_to = 1;
+    };
+
+    static constexpr u64 BLOCK = 32 * 1024;  // Numbers per growth sieve block
+
+    // Every root a u64 bound can need; 32-bit builds keep the address space
+    // for something else and stop at 2^28 (N ~ 7e16)
+    static constexpr u32 MAX_ROOT = sizeof(void*) >= 8 ? std::numeric_limits<u32>::max() : 1u << 28;
+
+    std::atomic<const Snapshot*> current{nullptr};
+    std::vector<std::unique_ptr<Snapshot>> history;
+    FixedArray<u32> store;
+    u32 max_root;
+    std::mutex mtx;
+
+    // max_root: the largest bound ensure() will be asked for
+    explicit BasePrimes(u64 root = MAX_ROOT) : max_root((u32)std::min<u64>(std::max<u64>(root, 100), MAX_ROOT)) {
+        if (!store.reserve(prime_count_bound(max_root), false)) {
+            fprintf(stderr, "BasePrimes: cannot map room for primes to %u\n", max_root);
+            abort();
+        }
+        history.emplace_back(new Snapshot);
+        history.back()->primes.p = store.data();
+        current.store(history.back().get(), std::memory_order_release);
+    }
+
+    const Snapshot* snapshot() const {
+        return current.load(std::memory_order_acquire);
+    }
+
+    // Append the primes in (done, target] to ps, growing ps to sqrt(target) first
+    template <class V>
+    static void extend(V& ps, u64 done, u64 target) {
+        u64 root = (u64)sqrt((double)target);
+        while (root * root > target) --root;
+        while ((root + 1) * (root + 1) <= target) ++root;
+        if (root > done) {
+            extend(ps, done, root);
+            done = root;
+        }
+
+        std::vector<u8> mark;
+        for (u64 lo = done + 1; lo <= target; lo += BLOCK) {
+            u64 hi = std::min(target, lo + BLOCK - 1);
+            mark.assign((size_t)(hi - lo + 1), 1);
+            size_t n = ps.size();
+            for (size_t i = 0; i < n; ++i) {
+                u64 p = ps[i];
+                if (p * p > hi) break;
+                u64 start = std::max(p * p, (lo + p - 1) / p * p);
+                for (u64 j = start; j <= hi; j += p) mark[(size_t)(j - lo)] = 0;
+            }
+            for (u64 i = std::max<u64>(lo, 2); i <= hi; ++i) {
+                if (mark[(size_t)(i - lo)]) ps.push_back((u32)i);
+            }
+        }
+    }
+
+    void ensure(u32 new_need) {
+        if (new_need <= snapshot()->sieved_to) return;
+        std::lock_guard<std::mutex> lk(mtx);
+        const Snapshot* old = current.load(std::memory_order_relaxed);
+        if (new_need <= old->sieved_to) return;
+        if (new_need > max_root) {
+            fprintf(stderr, "BasePrimes: need primes to %u, sized for %u\n", new_need, max_root);
+            abort();
+        }
+
+        u32 target = (u32)std::max<u64>(new_need, std::min<u64>(max_root, (u64)old->sieved_to * 2));
+
+        std::unique_ptr<Snapshot> next(new Snapshot);
+        extend(store, old->sieved_to, target);
+        next->primes = {store.data(), store.size()};
+        next->sieved_to = target;
+
+        current.store(next.get(), std::memory_order_release);
+        history.push_back(std::move(next));
+    }
+};
+
+// -------------------- Work allocator --------------------
+// Hands out chunk ids; the segments per chunk belong to the engine's
+// geometry (see Wheel below).
+//
+// Each thread keeps its claimed but unsieved chunks [next, end) in its own
+// deque and takes them from the front. Claims shrink near the end of a
+// range, or near the deadline to what the thread itself can still finish.
+// Once they do, a thread whose deque runs dry first steals the back half
+// of the fullest other deque, so a throttled or LITTLE core does not hold
+// chunks that everyone else is left waiting on. A parked thread (see
+// RunContext::active) hands its unstarted chunks back, and every claim
+// takes the lowest of those first.
+struct WorkAllocator {
+    // Contiguous mode: a thread claims RUN_CHUNKS consecutive chunks at a
+    // time, so its walked multiples and bucket state carry straight over
+    // from one chunk to the next and the division-based resync runs once
+    // per claim.
+    // Interleaved mode hands out one chunk per claim (the original scheme).
+    static constexpr u32 RUN_CHUNKS = 64;
+
+    // Every claim hits this counter: keep it on its own cache line, away
+    // from the read-only settings below. 64 bits: a u32 id wraps after
+    // 2^32 chunks, around 3.6e16 with the smallest chunks
+    alignas(64) std::atomic<u64> next_chunk{0};
+    alignas(64) bool contiguous = true;
+
+    // Range mode: chunks [0, total_chunks) exist, claims shrink towards the
+    // end so the last chunks spread over all threads
+    u64 total_chunks = std::numeric_limits<u64>::max();
+    unsigned threads = 1;
+
+    // Owner and thieves both lock; the owner takes it once per chunk
+    struct alignas(64) Deque {
+        std::mutex mtx;
+        u64 next = 0;
+        u64 end = 0;
+    };
+    std::unique_ptr<Deque[]> deques;
+
+    // Chunks handed back by parked threads
+    std::mutex orphan_mtx;
+    std::set<u64> orphans;
+    std::atomic<size_t> num_orphans{0};
+
+    // Per-thread claim state
+    struct Cursor {
+        unsigned tid = 0;
+        u64 budget = std::numeric_limits<u64>::max();  // Chunks it can still finish (timed mode)
+        u64 steals = 0;
+    };
+
+    void init(unsigned n) {
+        threads = n;
+        deques.reset(new Deque[n]);
+    }
+
+    u64 get_chunk(Cursor& cur) {
+        u64 orphan = ~0ULL;
+        if (swap_orphan(orphan)) return orphan;
+        Deque& own = deques[cur.tid];
+        {
+            std::lock_guard<std::mutex> lk(own.mtx);
+            if (own.next < own.end) return own.next++;
+        }
+        u32 n = contiguous ? RUN_CHUNKS : 1;
+        if (contiguous && total_chunks != std::numeric_limits<u64>::max()) {
+            u64 claimed = next_chunk.load(std::memory_order_relaxed);
+            u64 left = claimed < total_chunks ? total_chunks - claimed : 0;
+            n = (u32)std::min<u64>(RUN_CHUNKS, std::max<u64>(1, left / (2 * threads)));
+        }
+        if (contiguous) n = (u32)std::min<u64>(n, std::max<u64>(1, cur.budget / 2));
+        if (n < RUN_CHUNKS && contiguous) {
+            u64 first, end;
+            if (steal(cur.tid, first, end)) {
+                ++cur.steals;
+                std::lock_guard<std::mutex> lk(own.mtx);
+                own.next = first + 1;
+                own.end = end;
+                return first;
+            }
+        }
+        u64 first = next_chunk.fetch_add(n, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lk(own.mtx);
+        own.next = first + 1;
+        own.end = first + n;
+        return first;
+    }
+
+    // Splits off the back half of the fullest other deque (two chunks or more)
+    bool steal(unsigned tid, u64& first, u64& end) {
+        unsigned victim = tid;
+        u64 most = 1;
+        for (unsigned t = 0; t < threads; ++t) {
+            if (t == tid) continue;
+            std::lock_guard<std::mutex> lk(deques[t].mtx);
+            if (deques[t].end - deques[t].next > most) {
+                most = deques[t].end - deques[t].next;
+                victim = t;
+            }
+        }
+        if (victim == tid) return false;
+        Deque& d = deques[victim];
+        std::lock_guard<std::mutex> lk(d.mtx);
+        u64 left = d.end - d.next;
+        if (left < 2) return false;
+        end = d.end;
+        d.end -= left / 2;
+        first = d.end;
+        return true;
+    }
+
+    // Hands the unstarted chunks of a thread that stops claiming to the others
+    void park(unsigned tid) {
+        Deque& d = deques[tid];
+        std::lock_guard<std::mutex> lk(d.mtx);
+        if (d.next == d.end) return;
+        std::lock_guard<std::mutex> ok(orphan_mtx);
+        for (; d.next < d.end; ++d.next) orphans.insert(d.next);
+        num_orphans.store(orphans.size(), std::memory_order_relaxed);
+    }
+
+    // Trades chunk for the lowest handed-back one below it. A thread stuck
+    // on the tracker's ring may be waiting for exactly that chunk
+    bool swap_orphan(u64& chunk) {
+        if (!num_orphans.load(std::memory_order_relaxed)) return false;
+        std::lock_guard<std::mutex> lk(orphan_mtx);
+        if (orphans.empty() || *orphans.begin() > chunk) return false;
+        u64 low = *orphans.begin();
+        orphans.erase(orphans.begin());
+        if (chunk != ~0ULL) orphans.insert(chunk);
+        num_orphans.store(orphans.size(), std::memory_order_relaxed);
+        chunk = low;
+        return true;
+    }
+
+    // Range mode: every chunk has been claimed
+    bool exhausted() const {
+        return next_chunk.load(std::memory_order_relaxed) >= total_chunks;
+    }
+};
+
+// -------------------- Prime pair statistics --------------------
+// Optional (--tuples) twin / cousin / sexy pair counts and the largest
+// prime gap over a contiguous span [lo, hi). Spans fold left to right with
+// merge(): a worker folds the segments of a chunk, the tracker folds the
+// chunks in order, so pairs and gaps straddling any segment or chunk
+// boundary are counted exactly once. The up-to-6 numbers at each end of a
+// span are kept as bit masks for that.
+//
+// With --gaps every gap also lands in a GapHistogram and the maximal gaps
+// (each larger than all before it in the span) are kept in order. Gaps
+// inside a chunk go to the worker's own histogram; the one gap between two
+// chunks is only known to the tracker, which keeps those apart.
+struct GapHistogram {
+    static constexpr u32 BINS = 1024;   // Bin g / 2; the last one takes the rest
+
+    u64 count[BINS] = {};
+
+    void add(u64 gap) { ++count[gap / 2 < BINS ? gap / 2 : BINS - 1]; }
+    void clear() { memset(count, 0, sizeof(count)); }
+    void merge(const GapHistogram& b) {
+        for (u32 k = 0; k < BINS; ++k) count[k] += b.count[k];
+    }
+    u64 total() const {
+        u64 n = 0;
+        for (u32 k = 0; k < BINS; ++k) n += count[k];
+        return n;
+    }
+};
+
+struct GapRecord {
+    u64 gap;
+    u64 after;  // The prime opening it
+};
+
+struct PrimeStats {
+    static constexpr u32 NUM_GAPS = 3;
+    static constexpr u32 GAPS[NUM_GAPS] = {2, 4, 6};    // Twin, cousin, sexy
+    static constexpr u32 EDGE = 6;
+
+    u64 lo = 0, hi = 0;         // Empty while lo == hi
+    u64 pairs[NUM_GAPS] = {};   // (p, p + g) with both in the span
+    u64 first = 0, last = 0;    // 0 when the span holds no prime
+    u64 max_gap = 0;
+    u64 max_gap_at = 0;         // The prime opening that gap
+    u8 head = 0;                // Bit k: lo + k is prime
+    u8 tail = 0;                // Bit k: hi - EDGE + k is prime
+    std::vector<GapRecord> records;  // Maximal gaps, only kept with a histogram
+
+    bool empty() const { return lo == hi; }
+
+    // Appends the span starting where this one ends. With `hist`, the gap
+    // across the boundary is counted there and the records are kept.
+    void merge(const PrimeStats& b, GapHistogram* hist = nullptr) {
+        if (b.empty()) return;
+        if (empty()) {
+            *this = b;
+            return;
+        }
+        for (u32 k = 0; k < EDGE; ++k) {
+            if (!((tail >> k) & 1)) continue;
+            u64 p = hi - EDGE + k;
+            for (u32 g = 0; g < NUM_GAPS; ++g) {
+                u64 off = p + GAPS[g] - b.lo;
+                if (p + GAPS[g] >= b.lo && off < EDGE && ((b.head >> off) & 1)) ++pairs[g];
+            }
+        }
+        if (last && b.first) {
+            u64 gap = b.first - last;
+            if (hist) hist->add(gap);
+            if (gap > max_gap) {
+                max_gap = gap;
+                max_gap_at = last;
+                if (hist) records.push_back(GapRecord{gap, last});
+            }
+        }
+        if (hist) {
+            for (const auto& r : b.records) {
+                if (r.gap > max_gap) records.push_back(r);
+            }
+        }
+        if (b.max_gap > max_gap) {
+            max_gap = b.max_gap;
+            max_gap_at = b.max_gap_at;
+        }
+        for (u32 g = 0; g < NUM_GAPS; ++g) pairs[g] += b.pairs[g];
+        if (!first) first = b.first;
+        if (b.last) last = b.last;
+
+        u64 span_a = hi - lo, span_b = b.hi - b.lo;
+        if (span_a < EDGE) head = (u8)((head | (b.head << span_a)) & ((1u << EDGE) - 1));
+        tail = span_b < EDGE ? (u8)(b.tail | (tail >> span_b)) : b.tail;
+        hi = b.hi;
+    }
+};
+
+// The primes dividing the wheel modulus are in no bitmap: add the pairs
+// they open (their partners are at most 13), the gaps around them and
+// their bits at either end. `wheel` lists them in [lo, end), the span of st
+inline void add_wheel_primes(PrimeStats& st, const std::vector<u64>& wheel, u64 lo, u64 end, GapHistogram* hist) {
+    auto prime = [](u64 n) {
+        if (n < 2) return false;
+        for (u64 d = 2; d * d <= n; ++d) if (n % d == 0) return false;
+        return true;
+    };
+    for (u64 a : wheel) {
+        for (u32 g = 0; g < PrimeStats::NUM_GAPS; ++g) {
+            u64 b = a + PrimeStats::GAPS[g];
+            if (b >= lo && b < end && prime(b)) ++st.pairs[g];
+        }
+    }
+    std::vector<u64> seq = wheel;
+    if (st.first) seq.push_back(st.first);
+    PrimeStats lead;
+    for (size_t k = 1; k < seq.size(); ++k) {
+        u64 gap = seq[k] - seq[k - 1];
+        if (hist) hist->add(gap);
+        if (gap > lead.max_gap) {
+            lead.max_gap = gap;
+            lead.max_gap_at = seq[k - 1];
+            lead.records.push_back(GapRecord{gap, seq[k - 1]});
+        }
+    }
+    for (const auto& r : st.records) {
+        if (r.gap > lead.max_gap) lead.records.push_back(r);
+    }
+    st.records.swap(lead.records);
+    if (lead.max_gap >= st.max_gap) {
+        st.max_gap = lead.max_gap;
+        st.max_gap_at = lead.max_gap_at;
+    }
+    if (!wheel.empty()) {
+        st.first = wheel.front();
+        if (!st.last) st.last = wheel.back();
+    }
+    for (u64 p : wheel) {
+        if (p - st.lo < PrimeStats::EDGE) st.head |= (u8)(1u << (p - st.lo));
+        if (p + PrimeStats::EDGE >= st.hi) st.tail |= (u8)(1u << (p + PrimeStats::EDGE - st.hi));
+    }
+}
+
+// -------------------- Chunk completion tracker --------------------
+// Workers report every fully sieved chunk. The tracker folds the reports
+// into the largest contiguous prefix of finished chunks (the watermark) and
+// the exact prime count below it, so a timed run reports pi(N) for an exact
+// N and not a count over whatever ragged set of segments got done. Reports
+// sit in a ring indexed by chunk id, so a worker may run at most num_slots
+// chunks ahead of the watermark.
+// Folding is done by whichever thread gets the try_lock; nobody blocks.
+struct ChunkTracker {
+    struct Slot {
+        std::atomic<u64> done{0};   // Chunk id + 1 once the report is in
+        u64 count = 0;
+        u64 largest = 0;
+        u64 segments = 0;
+        PrimeStats stats;           // Only with --tuples / --gaps
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    u64 num_slots = 0;
+    std::atomic<u64> watermark{0};  // Chunks [0, watermark) are complete
+    u64 primes_below = 0;           // Guarded by mtx
+    u64 largest_below = 0;
+    u64 segments_below = 0;         // Sieved by this run, below the watermark
+    PrimeStats stats_below;         // Pair counts / gaps of this run's prefix
+    GapHistogram* boundary_gaps = nullptr;  // Gaps between chunks (--gaps)
+    std::mutex mtx;
+
+    // Start at chunk `start` with the totals of everything below it
+    void init(unsigned threads, u64 start, u64 count, u64 largest) {
+        num_slots = 1024;
+        while (num_slots < 4ull * threads * WorkAllocator::RUN_CHUNKS) num_slots *= 2;
+        slots.reset(new Slot[num_slots]);
+        watermark.store(start, std::memory_order_relaxed);
+        primes_below = count;
+        largest_below = largest;
+    }
+
+    bool has_room(u64 chunk) const {
+        return chunk < watermark.load(std::memory_order_acquire) + num_slots;
+    }
+
+    void complete(u64 chunk, u64 count, u64 largest, u64 segments, const PrimeStats* stats = nullptr) {
+        Slot& s = slots[chunk & (num_slots - 1)];
+        s.count = count;
+        s.largest = largest;
+        s.segments = segments;
+        if (stats) s.stats = *stats;
+        s.done.store(chunk + 1, std::memory_order_release);
+        advance(false);
+    }
+
+    void advance(bool wait) {
+        std::unique_lock<std::mutex> lk(mtx, std::defer_lock);
+        if (wait) lk.lock();
+        else if (!lk.try_lock()) return;
+        u64 wm = watermark.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& s = slots[wm & (num_slots - 1)];
+            if (s.done.load(std::memory_order_acquire) != wm + 1) break;
+            primes_below += s.count;
+            largest_below = std::max(largest_below, s.largest);
+            segments_below += s.segments;
+            stats_below.merge(s.stats, boundary_gaps);
+            ++wm;
+        }
+        watermark.store(wm, std::memory_order_release);
+    }
+
+    void snapshot(u64& wm, u64& count, u64& largest) {
+        std::lock_guard<std::mutex> lk(mtx);
+        wm = watermark.load(std::memory_order_relaxed);
+        count = primes_below;
+        largest = largest_below;
+    }
+
+    PrimeStats stats_snapshot() {
+        std::lock_guard<std::mutex> lk(mtx);
+        return stats_below;
+    }
+};
+
+// -------------------- Checkpoints --------------------
+// A small text file with the completed-chunk watermark and the totals
+// below it. It is written to a temp file and renamed over the old one, so
+// a power cut leaves either the previous or the new checkpoint on disk.
+struct Checkpoint {
+    static constexpr const char* MAGIC = "optimized_mc_pi-checkpoint";
+    static constexpr u32 VERSION = 1;
+
+    std::string engine;
+    bool bounded = false;
+    u64 lo = 0;
+    u64 hi = 0;
+    u64 chunk_span = 0;
+    u64 watermark = 0;      // Chunks counted from lo's chunk
+    u64 primes_below = 0;   // Bitmap primes only; the wheel primes are added at report time
+    u64 largest_below = 0;
+    u64 base_bound = 0;     // BasePrimes sieved_to when written
+
+    bool save(const char* path) const {
+        std::string tmp = std::string(path) + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "w");
+        if (!f) return false;
+        fprintf(f, "%s %u\n", MAGIC, VERSION);
+        fprintf(f, "engine %s\n", engine.c_str());
+        fprintf(f, "bounded %d\n", bounded ? 1 : 0);
+        fprintf(f, "lo %llu\n", (unsigned long long)lo);
+        fprintf(f, "hi %llu\n", (unsigned long long)hi);
+        fprintf(f, "chunk_span %llu\n", (unsigned long long)chunk_span);
+        fprintf(f, "watermark %llu\n", (unsigned long long)watermark);
+        fprintf(f, "primes_below %llu\n", (unsigned long long)primes_below);
+        fprintf(f, "largest_below %llu\n", (unsigned long long)largest_below);
+        fprintf(f, "base_bound %llu\n", (unsigned long long)base_bound);
+        bool ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+        ok = (fclose(f) == 0) && ok;
+        return ok && rename(tmp.c_str(), path) == 0;
+    }
+
+    bool load(const char* path) {
+        std::ifstream in(path);
+        std::string magic;
+        u32 version = 0;
+        if (!(in >> magic >> version) || magic != MAGIC || version != VERSION) return false;
+        std::string key;
+        unsigned long long v = 0;
+        int fields = 0;
+        while (in >> key) {
+            if (key == "engine") {
+                if (!(in >> engine)) return false;
+                ++fields;
+                continue;
+            }
+            if (!(in >> v)) return false;
+            if (key == "bounded") bounded = v != 0;
+            else if (key == "lo") lo = v;
+            else if (key == "hi") hi = v;
+            else if (key == "chunk_span") chunk_span = v;
+            else if (key == "watermark") watermark = v;
+            else if (key == "primes_below") primes_below = v;
+            else if (key == "largest_below") largest_below = v;
+            else if (key == "base_bound") base_bound = v;
+            else continue;
+            ++fields;
+        }
+        return fields == 9;
+    }
+};
+
+// -------------------- Wheel layouts --------------------
+// A layout stores one bit per integer coprime to its modulus M:
+//   bit k <-> (k / PHI) * M + RES[k % PHI]
+// M = 2 is the plain odd-only bitmap. M = 30 keeps 8 residues (one byte)
+// per 30 numbers, M = 210 keeps 48 residues (6 bytes) per 210 numbers, so
+// the same L1-sized segment covers 1.875x / 2.19x more of the number line.
+// The primes dividing M are never represented and are counted up front.
+constexpr u32 gcd_u32(u32 a, u32 b) {
+    while (b) { u32 t = a % b; a = b; b = t; }
+    return a;
+}
+
+//
+// SegBytes is the flag storage per segment and ChunkSegs the segments per
+// allocator chunk. The default 16KB x 32 is tuned for the Pi Zero 2W's 32KB
+// L1; see ENGINES for the alternatives picked at startup. A SubBytes below
+// SegBytes makes a two-level geometry: the segment is an L2-sized block of
+// L1-sized sub-segments, and only primes below a sub-segment are walked
+// once per sub-segment.
+template <u32 Mod, size_t SegBytes = 16 * 1024, int ChunkSegs = 32, size_t SubBytes = SegBytes>
+struct Wheel {
+    static constexpr u32 M = Mod;
+    static constexpr u32 PHI = [] {
+        u32 n = 0;
+        for (u32 r = 1; r < M; ++r) n += (gcd_u32(r, M) == 1);
+        return n;
+    }();
+
+    // Residues coprime to M, with RES[PHI] = M + 1 closing the cycle
+    static constexpr std::array<u32, PHI + 1> RES = [] {
+        std::array<u32, PHI + 1> r{};
+        u32 n = 0;
+        for (u32 x = 1; x < M; ++x) if (gcd_u32(x, M) == 1) r[n++] = x;
+        r[PHI] = M + 1;
+        return r;
+    }();
+
+    // Index of the smallest residue >= r (M - 1 is always a residue)
+    static constexpr std::array<u8, M> NEXT = [] {
+        std::array<u8, M> t{};
+        u32 i = 0;
+        for (u32 r = 0; r < M; ++r) {
+            while (RES[i] < r) ++i;
+            t[r] = (u8)i;
+        }
+        return t;
+    }();
+
+    // Marking p*q for q coprime to M: moving q to the next residue moves the
+    // bit position by (p / M) * STEP[wi] + CORR[class of p][wi]
+    static constexpr std::array<u32, PHI> STEP = [] {
+        std::array<u32, PHI> s{};
+        for (u32 i = 0; i < PHI; ++i) s[i] = (RES[i + 1] - RES[i]) * PHI;
+        return s;
+    }();
+
+    static constexpr std::array<std::array<u16, PHI>, PHI> CORR = [] {
+        std::array<std::array<u16, PHI>, PHI> c{};
+        for (u32 j = 0; j < PHI; ++j) {
+            for (u32 i = 0; i < PHI; ++i) {
+                u32 b = RES[j];
+                u32 r = (b * RES[i]) % M;
+                u32 t = r + b * (RES[i + 1] - RES[i]);
+                c[j][i] = (u16)((t / M) * PHI + NEXT[t % M] - NEXT[r]);
+            }
+        }
+        return c;
+    }();
+
+    // Primes dividing M (all are among the first few primes)
+    static constexpr u32 NUM_WHEEL_PRIMES = (M == 2) ? 1 : (M == 30) ? 3 : 4;
+    static constexpr u32 LARGEST_WHEEL_PRIME = (M == 2) ? 2 : (M == 30) ? 5 : 7;
+
+    // Segment geometry: whole wheel periods and whole u64 words
+    static constexpr u64 GROUP_BITS = 64 / gcd_u32(64, PHI) * PHI;
+    static_assert(SegBytes % SubBytes == 0, "a segment holds whole sub-segments");
+    static constexpr size_t SEG_BYTES = SegBytes;
+    static constexpr size_t SUB_BYTES = SubBytes;
+    static constexpr int CHUNK_SEGS = ChunkSegs;
+    static constexpr u64 SUB_BITS   = SUB_BYTES * 8 / GROUP_BITS * GROUP_BITS;
+    static constexpr size_t SUB_U64S = SUB_BITS / 64;
+    static constexpr u64 SEG_BITS   = SUB_BITS * (SEG_BYTES / SUB_BYTES);
+    static constexpr size_t SEG_U64S = SEG_BITS / 64;
+    static constexpr u64 SEG_SPAN   = SEG_BITS / PHI * M;
+    static constexpr u64 CHUNK_SPAN = SEG_SPAN * CHUNK_SEGS;
+
+    static constexpr u32 STEP_MAX = [] {
+        u32 m = 0;
+        for (u32 s : STEP) m = std::max(m, s);
+        return m;
+    }();
+
+    static u64 to_number(u64 bit) {
+        return bit / PHI * M + RES[bit % PHI];
+    }
+
+    // Bit distance from p*q to the next multiple, q at wheel index wi
+    static u64 step(u32 p, u32 wi) {
+        return (u64)(p / M) * STEP[wi] + CORR[NEXT[p % M]][wi];
+    }
+
+    // Index of the first bit whose number is >= n
+    static u64 bit_of(u64 n) {
+        return n / M * PHI + NEXT[n % M];
+    }
+
+    // First multiple p*q >= max(p*p, lo) with q coprime to M. Near 2^64 the
+    // product itself can overflow, so its bit index is assembled from
+    // q = qa * M + RES[i]: p*q / M = p*qa + p*RES[i] / M, and taking the
+    // bit index divides by M / PHI, which keeps it inside a u64.
+    static void sieve_start(u32 p, u64 lo, u64& bit, u8& wi) {
+        u64 q = std::max<u64>(p, lo / p + (lo % p != 0));
+        u32 i = NEXT[q % M];
+        u64 qa = q / M;
+        u64 r = (u64)p * RES[i];
+        bit = ((u64)p * qa + r / M) * PHI + NEXT[r % M];
+        wi = (u8)i;
+    }
+};
+
+using OddWheel = Wheel<2>;
+using Wheel30  = Wheel<30>;
+using Wheel210 = Wheel<210>;
+
+// -------------------- Pre-sieve pattern --------------------
+// The first few primes after the wheel primes cross off a pattern that
+// repeats every (their product) * M numbers. Each segment is initialised by
+// copying that pattern at the segment's phase instead of memset + marking
+// those primes one by one. The buffer holds one period plus one segment so
+// the copy never wraps. Byte-level phase assumes little-endian u64 words,
+// which holds on every target we build for (AArch64, ARMv7, x86).
+inline constexpr u32 SMALL_PRIMES[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29};
+
+template <class W>
+struct Presieve {
+    static constexpr size_t MAX_PERIOD_BYTES = 32 * 1024;
+
+    std::vector<u8> pattern;
+    size_t period_bytes = 1;
+    u32 num_primes = 0;     // Pre-sieved primes, following the wheel primes
+
+    Presieve() {
+        u64 period_bits = W::PHI;
+        for (u32 i = W::NUM_WHEEL_PRIMES; i < std::size(SMALL_PRIMES); ++i) {
+            u64 bits = period_bits * SMALL_PRIMES[i];
+            u64 bytes = bits / gcd_u32((u32)(bits % 8), 8); // Whole bytes per period
+            if (bytes > MAX_PERIOD_BYTES) break;
+            period_bits = bits;
+            period_bytes = bytes;
+            ++num_primes;
+        }
+
+        size_t total = period_bytes + W::SEG_U64S * sizeof(u64);
+        pattern.assign((total + 7) / 8 * 8, 0xFF);
+        u64* words = reinterpret_cast<u64*>(pattern.data());
+        for (u64 bit = 0; bit < (u64)total * 8; ++bit) {
+            u64 n = W::to_number(bit);
+            for (u32 k = 0; k < num_primes; ++k) {
+                if (n % SMALL_PRIMES[W::NUM_WHEEL_PRIMES + k] == 0) {
+                    clear_bit(words, bit);
+                    break;
+                }
+            }
+        }
+    }
+
+    static const Presieve& get() {
+        static const Presieve ps;
+        return ps;
+    }
+
+    // Initialise `words` words of flags starting at bit_lo (a multiple of 64)
+    void fill(u64* flags, u64 bit_lo, size_t words = W::SEG_U64S) const {
+        size_t phase = (size_t)((bit_lo / 8) % period_bytes);
+        memcpy(flags, pattern.data() + phase, words * sizeof(u64));
+        if (bit_lo == 0) {
+            // The pattern crosses off the pre-sieved primes themselves
+            for (u32 k = 0; k < num_primes; ++k) {
+                u32 p = SMALL_PRIMES[W::NUM_WHEEL_PRIMES + k];
+                u64 bit = W::bit_of(p);
+                flags[bit >> 6] |= 1ULL << (bit & 63);
+            }
+            clear_bit(flags, 0); // 1 is not prime
+        }
+    }
+};
+
+// -------------------- Small-prime word masks --------------------
+// The next few primes hit almost every word of a segment, so clearing their
+// multiples bit by bit costs more than rewriting the words. Multiples of p
+// repeat every p * PHI bits, i.e. every L = lcm(p * PHI, 64) / 64 words, so
+// each prime keeps one period of ready-made word masks (stored twice, so a
+// run of L words never wraps) and is applied as a plain AND stream over the
+// segment. That loop is branch-free and the compiler vectorises it.
+template <class W>
+struct SmallMasks {
+    static constexpr u32 MASK_LIMIT = 64; // Primes below this use masks
+
+    struct Entry {
+        u32 prime;
+        u32 period;         // L, in words
+        std::vector<u64> words;  // 2 * L masks
+    };
+
+    std::vector<Entry> entries;
+
+    explicit SmallMasks(u32 first) {
+        for (u32 p = first; p < MASK_LIMIT; p += 2) {
+            bool composite = false;
+            for (u32 d = 3; d * d <= p; d += 2) composite |= (p % d == 0);
+            if (composite) continue;
+
+            u64 period_bits = (u64)p * W::PHI;
+            Entry e;
+            e.prime = p;
+            e.period = (u32)(period_bits / gcd_u32((u32)(period_bits % 64), 64));
+            e.words.assign(2 * (size_t)e.period, ~0ULL);
+            for (u64 bit = 0; bit < (u64)e.words.size() * 64; ++bit) {
+                if (W::to_number(bit) % p == 0) clear_bit(e.words.data(), bit);
+            }
+            entries.push_back(std::move(e));
+        }
+    }
+
+    // Masks for the primes after the last pre-sieved one
+    static const SmallMasks& get() {
+        static const SmallMasks sm([] {
+            const Presieve<W>& ps = Presieve<W>::get();
+            return SMALL_PRIMES[W::NUM_WHEEL_PRIMES + ps.num_primes - 1] + 2;
+        }());
+        return sm;
+    }
+
+    // Cross off every masked prime in `words` words starting at bit_lo
+    void apply(u64* flags, u64 bit_lo, size_t words = W::SEG_U64S) const {
+        const u64 word_lo = bit_lo / 64;
+        for (const Entry& e : entries) {
+            const u64* t = e.words.data() + word_lo % e.period;
+            for (size_t w = 0; w < words; w += e.period) {
+                size_t n = std::min<size_t>(e.period, words - w);
+                u64* out = flags + w;
+                for (size_t k = 0; k < n; ++k) out[k] &= t[k];
+            }
+        }
+        if (bit_lo == 0) {
+            // The masks cross off the primes themselves
+            for (const Entry& e : entries) {
+                u64 bit = W::bit_of(e.prime);
+                flags[bit >> 6] |= 1ULL << (bit & 63);
+            }
+        }
+    }
+};
+
+// -------------------- Pair counting kernels --------------------
+// Twin-style pairs on the bitmap itself: for a gap g, the numbers of
+// residue class i pair with the bit d_i positions further on (d_i = 1..3 for
+// g = 2, 4, 6 in the odd layout, so twins are just f & (f >> 1)). Classes
+// sharing a shift share one AND with a class mask, which repeats every
+// lcm(PHI, 64) / 64 words. Pairs running past the segment's last word are
+// left to PrimeStats::merge.
+template <class W>
+struct PairMasks {
+    static constexpr u32 PERIOD = (u32)(W::GROUP_BITS / 64);
+
+    struct Shift {
+        u32 d;
+        u64 mask[PERIOD];
+    };
+    std::vector<Shift> shifts[PrimeStats::NUM_GAPS];
+
+    PairMasks() {
+        for (u32 g = 0; g < PrimeStats::NUM_GAPS; ++g) {
+            for (u32 i = 0; i < W::PHI; ++i) {
+                u32 r = W::RES[i] + PrimeStats::GAPS[g];
+                if (gcd_u32(r % W::M, W::M) != 1) continue;
+                u32 d = r / W::M * W::PHI + W::NEXT[r % W::M] - i;
+                auto it = find_if(shifts[g].begin(), shifts[g].end(), [&](const Shift& s) { return s.d == d; });
+                if (it == shifts[g].end()) {
+                    shifts[g].push_back(Shift{d, {}});
+                    it = shifts[g].end() - 1;
+                }
+                for (u64 bit = i; bit < (u64)PERIOD * 64; bit += W::PHI) it->mask[bit / 64] |= 1ULL << (bit % 64);
+            }
+        }
+    }
+
+    static const PairMasks& get() {
+        static const PairMasks pm;
+        return pm;
+    }
+};
+
+// Stats of one trimmed segment: numbers [lo, hi), bitmap from bit_lo.
+// Pairs are only counted with `pairs`; with `hist` every gap is binned.
+template <class W>
+PrimeStats segment_stats(const u64* f, u64 bit_lo, u64 lo, u64 hi, bool pairs, GapHistogram* hist) {
+    const PairMasks<W>& pm = PairMasks<W>::get();
+    PrimeStats st;
+    st.lo = lo;
+    st.hi = hi;
+    for (u32 g = 0; pairs && g < PrimeStats::NUM_GAPS; ++g) {
+        for (const auto& sh : pm.shifts[g]) {
+            u64 n = 0;
+            for (size_t w = 0; w < W::SEG_U64S; ++w) {
+                u64 next = w + 1 < W::SEG_U64S ? f[w + 1] : 0;
+                u64 partner = (f[w] >> sh.d) | (next << (64 - sh.d));
+                n += __builtin_popcountll(f[w] & partner & sh.mask[w % PairMasks<W>::PERIOD]);
+            }
+            st.pairs[g] += n;
+        }
+    }
+
+    // Gaps: the histogram needs all of them, the maximum alone only the
+    // bit distances that could beat it
+    u64 prev = ~0ULL;
+    if (hist) {
+        u64 a = 0;
+        for (size_t w = 0; w < W::SEG_U64S; ++w) {
+            for (u64 bits = f[w]; bits; bits &= bits - 1) {
+                u64 c = W::to_number(bit_lo + w * 64 + __builtin_ctzll(bits));
+                if (!a) {
+                    st.first = c;
+                } else {
+                    hist->add(c - a);
+                    if (c - a > st.max_gap) {
+                        st.max_gap = c - a;
+                        st.max_gap_at = a;
+                        st.records.push_back(GapRecord{c - a, a});
+                    }
+                }
+                a = c;
+            }
+        }
+        st.last = a;
+    }
+    for (size_t w = 0; !hist && w < W::SEG_U64S; ++w) {
+        for (u64 bits = f[w]; bits; bits &= bits - 1) {
+            u64 b = w * 64 + __builtin_ctzll(bits);
+            if (prev == ~0ULL) {
+                st.first = W::to_number(bit_lo + b);
+            } else if (((b - prev) / W::PHI + 1) * W::M > st.max_gap) {
+                u64 a = W::to_number(bit_lo + prev), c = W::to_number(bit_lo + b);
+                if (c - a > st.max_gap) {
+                    st.max_gap = c - a;
+                    st.max_gap_at = a;
+                }
+            }
+            prev = b;
+        }
+    }
+    if (prev != ~0ULL) st.last = W::to_number(bit_lo + prev);
+
+    // The numbers at either end, for pairs across the boundary
+    auto is_prime = [&](u64 n) {
+        if (n < lo || n >= hi) return false;
+        u64 b = W::bit_of(n);
+        return W::to_number(b) == n && ((f[(b - bit_lo) >> 6] >> ((b - bit_lo) & 63)) & 1);
+    };
+    for (u32 k = 0; k < PrimeStats::EDGE; ++k) {
+        if (is_prime(lo + k)) st.head |= (u8)(1u << k);
+        if (hi >= PrimeStats::EDGE - k && is_prime(hi - PrimeStats::EDGE + k)) st.tail |= (u8)(1u << k);
+    }
+    return st;
+}
+
+// -------------------- Walked primes --------------------
+// State of one prime below the bucket threshold, 8 bytes in a single array
+// the sieve loop streams through (instead of a u32 prime, a u64 absolute
+// multiple and a u8 wheel index in three). The prime is kept as its own bit
+// index, p / 2 for the odd engine, which is below SEG_BITS and leaves the
+// low bits for the wheel index of the next multiple's cofactor. The
+// multiple is an offset from the segment about to be sieved: a stride is
+// at most a few segments, so it fits 32 bits, and moving to the following
+// segment subtracts SEG_BITS.
+template <class W>
+struct WalkEntry {
+    static constexpr u32 WI_BITS = [] {
+        u32 b = 0;
+        while ((1u << b) < W::PHI) ++b;
+        return b;
+    }();
+    static_assert((W::SEG_BITS << WI_BITS) <= (1ull << 32), "segment too large for walked entries");
+
+    u32 off;        // Bit offset of the next multiple from the segment start
+    u32 code;       // bit_of(p) << WI_BITS | wheel index
+
+    u32 prime_bit() const { return code >> WI_BITS; }
+    u32 wi() const { return code & ((1u << WI_BITS) - 1); }
+
+    // First multiple of p at or past max(p*p, lo), lo the segment start
+    static WalkEntry start(u32 p, u64 lo) {
+        u64 bit;
+        u8 wi;
+        W::sieve_start(p, lo, bit, wi);
+        return {(u32)(bit - W::bit_of(lo)), (u32)W::bit_of(p) << WI_BITS | wi};
+    }
+};
+
+// -------------------- Bucket sieve --------------------
+// Primes above LARGE_MIN hit a segment at most a few times, so walking all
+// of them every segment is pure overhead at large N. In the style of
+// Oliveira e Silva, each large prime sits in exactly one bucket: the one for
+// the segment holding its next multiple. A segment only visits its own
+// bucket and re-files each prime under the segment of its following
+// multiple, so the cost per segment follows the actual hits. Buckets form a
+// ring indexed by segment id, kept wider than the largest prime's stride.
+// A bucket is a chain of fixed blocks from the worker's own pool: a sieved
+// bucket hands its blocks straight back, so the entries never reallocate
+// and the pool's huge-page regions only grow with the number of primes.
+template <class W>
+struct BucketSieve {
+    static constexpr u64 LARGE_MIN = W::SEG_SPAN;
+    static constexpr u32 OFF_BITS  = 26;                 // Bit offset in segment
+    static constexpr u32 OFF_MASK  = (1u << OFF_BITS) - 1;
+    static_assert(W::SEG_BITS <= OFF_MASK + 1ull, "segment too large for bucket entries");
+    static_assert(W::PHI <= (1u << (32 - OFF_BITS)), "wheel index does not fit bucket entries");
+
+    struct Entry {
+        u32 prime;
+        u32 off_wi;     // Offset in segment | wheel index << OFF_BITS
+    };
+
+    struct Block {
+        static constexpr u32 ENTRIES = 1022;    // 8KB blocks
+        Block* next;
+        u32 count;
+        Entry entries[ENTRIES];
+    };
+
+    // Blocks carved from REGION_BYTES regions, recycled through a free list
+    // and only unmapped with the pool
+    struct BlockPool {
+        static constexpr size_t REGION_BYTES = 4u << 20;
+        std::vector<Region> regions;
+        Block* free_list = nullptr;
+
+        Block* get() {
+            if (!free_list) {
+                Region r;
+                if (!r.map(REGION_BYTES, true)) {
+                    fprintf(stderr, "BucketSieve: cannot map bucket blocks\n");
+                    abort();
+                }
+                Block* b = static_cast<Block*>(r.base);
+                for (size_t k = 0; k < r.bytes / sizeof(Block); ++k) {
+                    b[k].next = free_list;
+                    free_list = &b[k];
+                }
+                regions.push_back(std::move(r));
+            }
+            Block* b = free_list;
+            free_list = b->next;
+            return b;
+        }
+
+        void put(Block* b) {
+            b->next = free_list;
+            free_list = b;
+        }
+    };
+
+    BlockPool pool;
+    std::vector<Block*> ring;        // Newest block of each bucket, nullptr when empty
+    u64 ring_mask = 0;
+    u64 next_seg = ~0ULL;       // Segment the ring expects next
+    size_t large_begin = 0;     // First base prime >= LARGE_MIN
+    size_t active_end = 0;      // Primes [large_begin, active_end) are filed
+    size_t known_primes = 0;
+
+    void push(u64 seg, Entry e) {
+        Block*& head = ring[seg & ring_mask];
+        if (!head || head->count == Block::ENTRIES) {
+            Block* b = pool.get();
+            b->next = head;
+            b->count = 0;
+            head = b;
+        }
+        head->entries[head->count++] = e;
+    }
+
+    void release(Block*& head) {
+        while (head) {
+            Block* next = head->next;
+            pool.put(head);
+            head = next;
+        }
+    }
+
+    void insert(u32 p, u64 lo) {
+        u64 bit;
+        u8 wi;
+        W::sieve_start(p, lo, bit, wi);
+        push(bit / W::SEG_BITS, {p, (u32)(bit % W::SEG_BITS) | ((u32)wi << OFF_BITS)});
+    }
+
+    // Re-file every entry for a wider ring; slot k currently holds segment
+    // seg_id + ((k - seg_id) & old mask)
+    void grow(u64 seg_id, u64 min_slots) {
+        size_t slots = std::max<size_t>(ring.size(), 16);
+        while (slots < min_slots) slots *= 2;
+        std::vector<Block*> old;
+        old.swap(ring);
+        ring.assign(slots, nullptr);
+        u64 old_mask = ring_mask;
+        ring_mask = slots - 1;
+        for (u64 k = 0; k < old.size(); ++k) {
+            u64 s = seg_id + ((k - seg_id) & old_mask);
+            ring[s & ring_mask] = old[k];
+        }
+    }
+
+    // Position the ring at segment seg_id covering [lo, hi) and file any
+    // base primes whose square now falls below hi. A jump to a segment that
+    // does not follow the previous one re-files from scratch (one division
+    // per large prime).
+    void advance(const BasePrimes::PrimeList& primes, u64 seg_id, u64 lo, u64 hi) {
+        if (primes.size() != known_primes) {
+            known_primes = primes.size();
+            large_begin = std::lower_bound(primes.begin(), primes.end(), LARGE_MIN) - primes.begin();
+            active_end = std::max(active_end, large_begin);
+        }
+        if (ring.empty()) grow(seg_id, 16);
+        if (seg_id != next_seg) {
+            for (auto& b : ring) release(b);
+            active_end = large_begin;
+        }
+        next_seg = seg_id + 1;
+
+        while (active_end < primes.size() && (u64)primes[active_end] * primes[active_end] < hi) {
+            u32 p = primes[active_end++];
+            u64 stride_segs = ((u64)p / W::M + 1) * W::STEP_MAX / W::SEG_BITS + 2;
+            if (stride_segs > ring.size()) grow(seg_id, stride_segs);
+            insert(p, lo);
+        }
+    }
+
+    // Cross off this segment's hits and re-file each prime
+    void sieve(u64* flags, u64 seg_id) {
+        Block* b = ring[seg_id & ring_mask];
+        ring[seg_id & ring_mask] = nullptr;
+        while (b) {
+            for (u32 k = 0; k < b->count; ++k) {
+                const Entry& e = b->entries[k];
+                u32 p = e.prime;
+                u64 off = e.off_wi & OFF_MASK;
+                u32 wi = e.off_wi >> OFF_BITS;
+                do {
+                    clear_bit(flags, off);
+                    off += W::step(p, wi);
+                    if (++wi == W::PHI) wi = 0;
+                } while (off < W::SEG_BITS);
+                push(seg_id + off / W::SEG_BITS, {p, (u32)(off % W::SEG_BITS) | (wi << OFF_BITS)});
+            }
+            Block* next = b->next;
+            pool.put(b);
+            b = next;
+        }
+    }
+};
+
+// -------------------- Prime output --------------------
+// Optional compact output stage. Odd primes are written as LEB128 varints
+// of half the gap to the previous one, one byte for any gap below 256, so
+// about 10x denser than one prime per text line. Each worker encodes one
+// block per chunk and hands it to a single writer thread through its own
+// SPSC ring. The writer emits blocks strictly in chunk order, so the file
+// is always an ordered prefix of the range. A full ring makes its worker
+// wait, which bounds memory at SLOTS blocks per thread.
+//
+// File: "PVAR" | u32 version | u64 lo | u64 hi (covered, set at close) |
+//       u64 flags (bit 0: prime 2 is in range) | varints
+// Decode from prev = 1: p = prev + 2 * v.
+struct OutBlock {
+    u64 seq = 0;            // Chunk sequence number, from 0
+    u64 end = 0;            // One past the last number covered
+    u64 first = 0;          // First prime in the block, 0 if none
+    u64 last = 0;
+    u64 count = 0;
+    bool partial = false;   // Cut short by the deadline, nothing follows
+    std::vector<u8> bytes;       // Varint gaps after first
+
+    void reset(u64 s) {
+        seq = s;
+        end = first = last = count = 0;
+        partial = false;
+        bytes.clear();
+    }
+
+    void add(u64 p) {
+        if (count++ == 0) first = p;
+        else put_varint(bytes, (p - last) >> 1);
+        last = p;
+    }
+
+    static void put_varint(std::vector<u8>& out, u64 v) {
+        while (v >= 0x80) {
+            out.push_back((u8)(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back((u8)v);
+    }
+};
+
+struct SpscRing {
+    static constexpr size_t SLOTS = 4;
+
+    OutBlock slots[SLOTS];
+    std::atomic<u64> head{0};   // Next slot the writer reads
+    std::atomic<u64> tail{0};   // Next slot the worker fills
+
+    // Swaps b into the ring; b comes back holding a drained buffer to reuse
+    bool push(OutBlock& b) {
+        u64 t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == SLOTS) return false;
+        std::swap(slots[t % SLOTS], b);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    OutBlock* front() {
+        u64 h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return nullptr;
+        return &slots[h % SLOTS];
+    }
+
+    void pop() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+struct PrimeWriter {
+    static constexpr u32 VERSION = 1;
+    static constexpr size_t HI_OFFSET = 16;
+
+    FILE* file = nullptr;
+    std::vector<std::unique_ptr<SpscRing>> rings;
+    std::atomic<unsigned> producers_left{0};
+    std::thread th;
+
+    u64 lo = 0;
+    u64 covered_end = 0;    // One past the last number written
+    u64 prev = 1;
+    u64 next_seq = 0;
+    u64 primes_written = 0;
+    u64 bytes_written = 0;
+    u64 blocks_dropped = 0;
+    bool stopped = false;
+    std::vector<u8> scratch;
+
+    // Opens path and starts the writer at chunk first_seq; lead are the odd
+    // primes in range that the bitmaps do not hold (the odd wheel primes)
+    bool open(const char* path, u64 range_lo, u64 first_seq, bool has_two, const std::vector<u64>& lead,
+              unsigned producers) {
+        file = fopen(path, "wb");
+        if (!file) return false;
+        setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+        lo = covered_end = range_lo;
+        next_seq = first_seq;
+        u64 hi = 0, flags = has_two ? 1 : 0;
+        fwrite("PVAR", 1, 4, file);
+        fwrite(&VERSION, sizeof(VERSION), 1, file);
+        fwrite(&lo, sizeof(lo), 1, file);
+        fwrite(&hi, sizeof(hi), 1, file);
+        fwrite(&flags, sizeof(flags), 1, file);
+        bytes_written = 32;
+        primes_written = has_two ? 1 : 0;
+
+        scratch.clear();
+        for (u64 p : lead) {
+            OutBlock::put_varint(scratch, (p - prev) >> 1);
+            prev = p;
+            ++primes_written;
+        }
+        emit(scratch.data(), scratch.size());
+
+        rings.clear();
+        for (unsigned i = 0; i < producers; ++i) rings.emplace_back(new SpscRing);
+        producers_left.store(producers, std::memory_order_relaxed);
+        th = std::thread(&PrimeWriter::run, this);
+        return true;
+    }
+
+    void submit(unsigned tid, OutBlock& b) {
+        while (!rings[tid]->push(b)) std::this_thread::yield();
+    }
+
+    void producer_done() {
+        producers_left.fetch_sub(1, std::memory_order_release);
+    }
+
+    void emit(const u8* data, size_t n) {
+        if (n) fwrite(data, 1, n, file);
+        bytes_written += n;
+    }
+
+    void write_block(const OutBlock& b) {
+        if (b.count) {
+            scratch.clear();
+            OutBlock::put_varint(scratch, (b.first - prev) >> 1);
+            emit(scratch.data(), scratch.size());
+            emit(b.bytes.data(), b.bytes.size());
+            prev = b.last;
+            primes_written += b.count;
+        }
+        covered_end = b.end;
+    }
+
+    void run() {
+        for (;;) {
+            bool progressed = false;
+            for (auto& ring : rings) {
+                OutBlock* b;
+                while ((b = ring->front()) && (stopped || b->seq == next_seq)) {
+                    if (stopped) {
+                        ++blocks_dropped;
+                    } else {
+                        write_block(*b);
+                        ++next_seq;
+                        stopped = b->partial;
+                    }
+                    ring->pop();
+                    progressed = true;
+                }
+            }
+            if (progressed) continue;
+            if (producers_left.load(std::memory_order_acquire) == 0) {
+                // Everything is pushed; whatever is left is past a gap
+                bool any = false;
+                for (auto& ring : rings) any |= ring->front() != nullptr;
+                if (!any) break;
+                stopped = true;
+                continue;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // Joins the writer and records the covered range in the header
+    void close() {
+        if (!file) return;
+        th.join();
+        u64 hi = covered_end ? covered_end - 1 : 0;
+        fseek(file, HI_OFFSET, SEEK_SET);
+        fwrite(&hi, sizeof(hi), 1, file);
+        fclose(file);
+        file = nullptr;
+    }
+};
+
+// -------------------- Segment archive --------------------
+// Range runs can persist every finished segment bitmap into an mmap'd file
+// of consecutive blocks, one per segment, and workers sieve straight into
+// their block. Next to the blocks sits an index with the cumulative prime
+// count before each segment, so pi(x), the nth prime and "primes in [a, b]"
+// are an index lookup plus one popcount over a partial block, with no
+// re-sieving. The file is only usable once `complete` is set at the end.
+//
+// Layout: header page | index (u64 per segment) | blocks, page aligned.
+struct ArchiveHeader {
+    char magic[4];          // "PARC"
+    u32 version;
+    u32 modulus;            // Wheel layout of the blocks
+    u32 seg_u64s;
+    u64 seg_bits;
+    u64 seg_span;
+    u64 first_seg;          // Absolute segment id of block 0
+    u64 num_segs;
+    u64 lo, hi;             // Range covered, inclusive
+    u64 lead_count;         // Primes in range that the bitmaps do not hold
+    u64 lead[4];
+    u64 complete;
+    u64 index_offset;
+    u64 data_offset;
+};
+
+struct PrimeArchive {
+    static constexpr u32 VERSION = 1;
+    static constexpr size_t PAGE = 4096;
+
+    int fd = -1;
+    u8* base = nullptr;
+    size_t bytes = 0;
+    ArchiveHeader* hdr = nullptr;
+    u64* index = nullptr;
+    u8* data = nullptr;
+
+    static size_t page_round(size_t n) { return (n + PAGE - 1) / PAGE * PAGE; }
+
+    bool map(const char* path, bool writable, size_t size) {
+        fd = writable ? ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644) : ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        if (writable) {
+            if (ftruncate(fd, (off_t)size) != 0) return false;
+        } else {
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ArchiveHeader)) return false;
+            size = (size_t)st.st_size;
+        }
+        void* p = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) return false;
+        base = (u8*)p;
+        bytes = size;
+        hdr = (ArchiveHeader*)base;
+        return true;
+    }
+
+    template <class W>
+    bool create(const char* path, u64 lo, u64 hi, const std::vector<u64>& lead) {
+        u64 first_seg = lo / W::SEG_SPAN;
+        u64 num_segs = hi / W::SEG_SPAN - first_seg + 1;
+        size_t index_offset = PAGE;
+        size_t data_offset = page_round(index_offset + num_segs * sizeof(u64));
+        if (!map(path, true, data_offset + num_segs * W::SEG_U64S * sizeof(u64))) return false;
+
+        memcpy(hdr->magic, "PARC", 4);
+        hdr->version = VERSION;
+        hdr->modulus = W::M;
+        hdr->seg_u64s = (u32)W::SEG_U64S;
+        hdr->seg_bits = W::SEG_BITS;
+        hdr->seg_span = W::SEG_SPAN;
+        hdr->first_seg = first_seg;
+        hdr->num_segs = num_segs;
+        hdr->lo = lo;
+        hdr->hi = hi;
+        hdr->lead_count = lead.size();
+        for (size_t i = 0; i < lead.size() && i < 4; ++i) hdr->lead[i] = lead[i];
+        hdr->complete = 0;
+        hdr->index_offset = index_offset;
+        hdr->data_offset = data_offset;
+        attach();
+        return true;
+    }
+
+    bool open_read(const char* path) {
+        if (!map(path, false, 0)) return false;
+        if (memcmp(hdr->magic, "PARC", 4) != 0 || hdr->version != VERSION || !hdr->complete) return false;
+        if (hdr->data_offset + hdr->num_segs * hdr->seg_u64s * sizeof(u64) > bytes) return false;
+        attach();
+        return true;
+    }
+
+    void attach() {
+        index = (u64*)(base + hdr->index_offset);
+        data = base + hdr->data_offset;
+    }
+
+    u64* segment(u64 seg_id) {
+        return (u64*)(data + (seg_id - hdr->first_seg) * hdr->seg_u64s * sizeof(u64));
+    }
+
+    const u64* block(u64 i) const {
+        return (const u64*)(data + i * hdr->seg_u64s * sizeof(u64));
+    }
+
+    // Workers store per-segment counts; turn them into exclusive prefix sums
+    void finish() {
+        u64 sum = 0;
+        for (u64 i = 0; i < hdr->num_segs; ++i) {
+            u64 c = index[i];
+            index[i] = sum;
+            sum += c;
+        }
+        hdr->complete = 1;
+        msync(base, bytes, MS_SYNC);
+    }
+
+    u64 total() const {
+        u64 last = hdr->num_segs - 1;
+        return hdr->lead_count + index[last] + popcount_array(block(last), hdr->seg_u64s);
+    }
+
+    void close() {
+        if (base) munmap(base, bytes);
+        if (fd >= 0) ::close(fd);
+        base = nullptr;
+        fd = -1;
+    }
+};
+
+// -------------------- CPU placement --------------------
+// Optional pinning of the workers to fixed CPUs. CPUs are ordered one per
+// physical core first (SMT siblings after), so N workers land on N distinct
+// cores whenever there are enough. Keeping a core free leaves the first
+// core (the one with cpu 0, where sshd and most IRQs end up on a Pi) to the
+// OS, the writer and the checkpoint thread. Linux only; elsewhere pinning
+// is refused at startup.
+struct CpuPlan {
+    std::vector<int> workers;    // CPU for worker i is workers[i % size]
+    std::vector<int> reserved;   // CPUs of the kept-free core, empty if none
+};
+
+inline int read_sysfs_int(const std::string& path) {
+    std::ifstream in(path);
+    int v = -1;
+    if (!(in >> v)) return -1;
+    return v;
+}
+
+inline bool plan_cpus(bool keep_free, CpuPlan& plan) {
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return false;
+
+    // (package, core) of every CPU we are allowed to run on
+    struct Cpu { int package, core, cpu; };
+    std::vector<Cpu> cpus;
+    for (int c = 0; c < CPU_SETSIZE; ++c) {
+        if (!CPU_ISSET(c, &set)) continue;
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(c) + "/topology/";
+        int package = read_sysfs_int(dir + "physical_package_id");
+        int core = read_sysfs_int(dir + "core_id");
+        cpus.push_back({package, core < 0 ? c : core, c});
+    }
+    if (cpus.empty()) return false;
+
+    // Group the SMT siblings of each core, cores in order of their first CPU
+    std::vector<std::vector<int>> cores;
+    std::map<std::pair<int, int>, size_t> slot;
+    for (const Cpu& c : cpus) {
+        auto key = std::make_pair(c.package, c.core);
+        auto it = slot.find(key);
+        if (it == slot.end()) {
+            it = slot.emplace(key, cores.size()).first;
+            cores.emplace_back();
+        }
+        cores[it->second].push_back(c.cpu);
+    }
+    if (keep_free && cores.size() > 1) {
+        plan.reserved = cores.front();
+        cores.erase(cores.begin());
+    }
+
+    // First sibling of every core, then the second of every core, ...
+    for (size_t k = 0;; ++k) {
+        bool any = false;
+        for (const auto& core : cores) {
+            if (k < core.size()) {
+                plan.workers.push_back(core[k]);
+                any = true;
+            }
+        }
+        if (!any) break;
+    }
+    return true;
+#else
+    (void)keep_free;
+    (void)plan;
+    return false;
+#endif
+}
+
+// Restrict a thread to the given CPUs
+inline bool pin_thread(pthread_t th, const std::vector<int>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus) CPU_SET(c, &set);
+    return pthread_setaffinity_np(th, sizeof(set), &set) == 0;
+#else
+    (void)th;
+    (void)cpus;
+    return false;
+#endif
+}
+
+// CPU the calling thread is on, -1 if unknown
+inline int current_cpu() {
+#ifdef __linux__
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+// -------------------- Verification --------------------
+// --verify: workers hand every Nth finished segment (count plus a few of its
+// primes) to a background thread, which recounts the segment with a plain
+// byte sieve written independently of the engines and runs Miller-Rabin on
+// the primes. The recount needs every prime to sqrt(hi), so it stops at
+// RECOUNT_MAX; segments above it get the Miller-Rabin check alone. Only
+// sampled segments take the queue lock, and without --verify the worker
+// does a single null check per segment.
+// Double precision is within one of the root; no long double, which is
+// soft-float on some ARM ABIs
+inline u64 isqrt(u64 n) {
+    u64 r = std::min<u64>((u64)sqrt((double)n), 0xFFFFFFFFULL);
+    while (r > 0 && r * r > n) --r;
+    while ((r + 1) <= 0xFFFFFFFFULL && (r + 1) * (r + 1) <= n) ++r;
+    return r;
+}
+
+// a * b mod m. 32-bit targets (ARMv7) have no 128-bit integers and fall
+// back to double-and-add, 64 steps but only taken by --verify
+inline u64 mulmod(u64 a, u64 b, u64 m) {
+#if defined(__SIZEOF_INT128__)
+    return (u64)((unsigned __int128)a * b % m);
+#else
+    // Sums stay below m without overflowing: x + y >= m is x >= m - y
+    auto addmod = [m](u64 x, u64 y) { return x >= m - y ? x - (m - y) : x + y; };
+    u64 r = 0;
+    for (a %= m, b %= m; b; b >>= 1) {
+        if (b & 1) r = addmod(r, a);
+        a = addmod(a, a);
+    }
+    return r;
+#endif
+}
+
+inline u64 powmod(u64 a, u64 e, u64 m) {
+    u64 r = 1;
+    for (a %= m; e; e >>= 1) {
+        if (e & 1) r = mulmod(r, a, m);
+        a = mulmod(a, a, m);
+    }
+    return r;
+}
+
+// Deterministic for all 64-bit n (Jim Sinclair's seven bases)
+inline bool miller_rabin(u64 n) {
+    if (n < 2) return false;
+    for (u64 p : {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37}) {
+        if (n % p == 0) return n == p;
+    }
+    u64 d = n - 1;
+    int r = 0;
+    while ((d & 1) == 0) {
+        d >>= 1;
+        ++r;
+    }
+    for (u64 a : {2ULL, 325ULL, 9375ULL, 28178ULL, 450775ULL, 9780504ULL, 1795265022ULL}) {
+        u64 x = powmod(a, d, n);
+        if (x == 0 || x == 1 || x == n - 1) continue;
+        bool composite = true;
+        for (int i = 1; i < r && composite; ++i) {
+            x = mulmod(x, x, n);
+            composite = x != n - 1;
+        }
+        if (composite) return false;
+    }
+    return true;
+}
+
+struct VerifySample {
+    u64 lo, hi;             // Numbers [lo, hi) the segment's bitmap covers
+    u64 skip_below;         // Primes below this are not in the bitmap
+    u64 count;
+    u32 num_primes = 0;
+    u64 primes[4];
+};
+
+struct Verifier {
+    u64 every = 64;         // Sample segments with seg_id % every == 0
+    size_t max_queue = 16;  // Samples past this are dropped, not queued
+    static constexpr u64 RECOUNT_MAX = 100000000000000ULL;  // 1e14: primes to 1e7, 2.6MB
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<VerifySample> queue;
+    bool stopping = false;
+    std::thread th;
+
+    // Results, read after stop()
+    u64 segments_checked = 0;
+    u64 count_mismatches = 0;
+    u64 primes_tested = 0;
+    u64 composites = 0;
+    u64 above_recount = 0;      // Past RECOUNT_MAX: Miller-Rabin only
+    u64 dropped = 0;            // Queue full, or still queued at stop()
+    double busy_seconds = 0;    // Spent checking, on the verify thread
+
+    std::vector<u32> small;      // Reference primes, extended on demand
+    u64 small_to = 1;
+
+    bool wants(u64 seg_id) const { return seg_id % every == 0; }
+
+    // A verifier that falls behind drops samples rather than growing the
+    // queue and the drain at stop()
+    void submit(const VerifySample& s) {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (queue.size() >= max_queue) {
+                ++dropped;
+                return;
+            }
+            queue.push_back(s);
+        }
+        cv.notify_one();
+    }
+
+    // Primes up to n, sieved in blocks onto the list so far
+    void extend_small(u64 n) {
+        if (n <= small_to) return;
+        BasePrimes::extend(small, small_to, n);
+        small_to = n;
+    }
+
+    // Primes in [lo, hi) with a byte per number
+    u64 reference_count(u64 lo, u64 hi, u64 skip_below) {
+        if (hi <= lo) return 0;
+        extend_small(isqrt(hi - 1));
+        std::vector<u8> composite(hi - lo, 0);
+        // Offsets from lo: the next multiple of p may lie past 2^64
+        for (u32 p : small) {
+            u64 sq = (u64)p * p;
+            u64 m = sq > lo ? sq - lo : (p - lo % p) % p;
+            for (; m < hi - lo; m += p) composite[m] = 1;
+        }
+        u64 n = 0;
+        for (u64 i = 0; i < hi - lo; ++i) n += !composite[i] && lo + i >= std::max<u64>(2, skip_below);
+        return n;
+    }
+
+    void check(const VerifySample& s) {
+        if (s.hi > RECOUNT_MAX) {
+            ++above_recount;
+        } else {
+            u64 want = reference_count(s.lo, s.hi, s.skip_below);
+            ++segments_checked;
+            if (want != s.count) {
+                ++count_mismatches;
+                std::cerr << "Verify: [" << s.lo << ", " << s.hi << ") has " << want << " primes, the sieve counted "
+                     << s.count << "\n";
+            }
+        }
+        for (u32 k = 0; k < s.num_primes; ++k) {
+            ++primes_tested;
+            if (!miller_rabin(s.primes[k])) {
+                ++composites;
+                std::cerr << "Verify: sieve reported composite " << s.primes[k] << "\n";
+            }
+        }
+    }
+
+    void start() {
+        th = std::thread([this] {
+            std::unique_lock<std::mutex> lk(mtx);
+            for (;;) {
+                cv.wait(lk, [&] { return stopping || !queue.empty(); });
+                if (queue.empty()) break;
+                VerifySample s = queue.front();
+                queue.pop_front();
+                lk.unlock();
+                auto t0 = std::chrono::steady_clock::now();
+                check(s);
+                busy_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                lk.lock();
+            }
+        });
+    }
+
+    // Drops whatever is still queued, finishes the sample in hand and joins
+    void stop() {
+        if (!th.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            dropped += queue.size();
+            queue.clear();
+            stopping = true;
+        }
+        cv.notify_all();
+        th.join();
+    }
+};
+
+// -------------------- Phase profiling --------------------
+// Built with -DSIEVE_PROFILE, every worker splits its time per segment into
+// the phases below with the cheapest clock the CPU has: cntvct_el0 on
+// AArch64 (fixed frequency, cntfrq_el0), the TSC on x86, steady_clock
+// elsewhere. Without the flag PhaseTimer is empty and compiles away.
+enum Phase { PH_SETUP, PH_INIT, PH_SMALL, PH_MEDIUM, PH_LARGE, PH_COUNT, PH_OUTPUT, PH_SCAN, NUM_PHASES };
+inline const char* const PHASE_NAMES[NUM_PHASES] = {
+    "setup", "init", "small", "medium", "large", "count", "output", "scan",
+};
+
+#ifdef SIEVE_PROFILE
+inline u64 read_ticks() {
+#if defined(__aarch64__)
+    u64 t;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    auto since = std::chrono::steady_clock::now().time_since_epoch();
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(since).count();
+#endif
+}
+
+// Unit name and (when the counter has a fixed known rate) ticks per second
+inline const char* tick_unit(double& hz) {
+#if defined(__aarch64__)
+    u64 f;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(f));
+    hz = (double)f;
+    return "cntvct ticks";
+#elif defined(__x86_64__) || defined(__i386__)
+    hz = 0.0;
+    return "TSC ticks";
+#else
+    hz = 1e9;
+    return "ns";
+#endif
+}
+
+struct PhaseTimer {
+    u64 ticks[NUM_PHASES] = {};
+    u64 last = 0;
+
+    void start() { last = read_ticks(); }
+    void lap(Phase p) {
+        u64 t = read_ticks();
+        ticks[p] += t - last;
+        last = t;
+    }
+};
+#else
+struct PhaseTimer {
+    void start() {}
+    void lap(Phase) {}
+};
+#endif
+
+// --perf: hardware counters over each worker's whole run, read once at the
+// end, so the loop makes no syscalls; the report divides by segments
+enum PerfEvent { PE_L1D_MISS, PE_LLC_MISS, PE_BRANCH_MISS, NUM_PERF_EVENTS };
+inline const char* const PERF_NAMES[NUM_PERF_EVENTS] = {
+    "L1D read misses", "LLC misses (L2 on the A53)", "branch misses",
+};
+
+struct PerfCounters {
+    int fd[NUM_PERF_EVENTS] = {-1, -1, -1};
+
+    // Counts the calling thread only
+    bool open() {
+#ifdef PRIME_SIEVE_HAVE_PERF_EVENTS
+        const std::pair<u32, u64> events[NUM_PERF_EVENTS] = {
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+        bool any = false;
+        for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = events[e].first;
+            attr.config = events[e].second;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd[e] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            any |= fd[e] >= 0;
+        }
+        return any;
+#else
+        return false;
+#endif
+    }
+
+    // Values since open(), ~0 for events the kernel or CPU refused
+    void read_all(u64* out) {
+        for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+            out[e] = ~0ULL;
+            if (fd[e] < 0) continue;
+            u64 v = 0;
+            if (read(fd[e], &v, sizeof(v)) == (ssize_t)sizeof(v)) out[e] = v;
+            close(fd[e]);
+            fd[e] = -1;
+        }
+    }
+};
+
+// -------------------- Thread worker --------------------
+// Timed mode sieves upwards from lo (0 unless started elsewhere) until the
+// deadline. Range mode counts exactly the primes in [lo, hi] with no clock
+// reads in the loop.
+//
+// Bounds stop at MAX_BOUND: 2^64 - 1 = 3 * 5 * 17 * 257 * 641 * 65537 *
+// 6700417 is composite, so every count up to 2^64 stays exact while hi + 1
+// and each segment's exclusive end still fit a u64.
+constexpr u64 MAX_BOUND = std::numeric_limits<u64>::max() - 1;
+
+struct RunLimits {
+    double seconds = 10.0;
+    bool bounded = false;
+    u64 lo = 0;
+    u64 hi = MAX_BOUND;     // Also the end of a timed run
+};
+
+// One finished segment, as handed to a RunContext's on_segment hook. The
+// bitmap is the worker's own buffer (zero-copy) and is only valid during
+// the call. Bit k stands for to_number(bit_base + k) in the engine's wheel
+// layout; the primes dividing the modulus are never in a bitmap.
+struct SegmentView {
+    const u64* bitmap;
+    size_t words;
+    u64 bit_base;
+    u64 lo, hi;                 // Numbers [lo, hi) covered, trimmed to the run
+    u64 count;                  // Primes set in the bitmap
+    u32 modulus;
+    u64 (*to_number)(u64 bit);
+
+    u64 number(u64 k) const { return to_number(bit_base + k); }
+};
+
+// Shared state for one run, handed to every worker
+struct RunContext {
+    RunLimits limits;
+    BasePrimes* base = nullptr;
+    WorkAllocator* alloc = nullptr;
+    PrimeWriter* writer = nullptr;      // Optional compact prime output
+    PrimeArchive* archive = nullptr;    // Optional bitmap archive (range mode)
+    ChunkTracker* tracker = nullptr;
+    bool perf = false;                  // Open hardware counters per worker
+    Verifier* verifier = nullptr;       // Optional --verify sampling
+    bool tuples = false;                // Fold PrimeStats per chunk
+    bool gaps = false;                  // ... with a gap histogram per thread
+    bool lite = false;                  // No per-segment largest prime (--stats-lite)
+
+    // Optional thread governor: workers tid >= *active park between chunks
+    const std::atomic<unsigned>* active = nullptr;
+
+    // Optional per-segment callback (library use)
+    void (*on_segment)(void* user, const SegmentView& view) = nullptr;
+    void* on_segment_user = nullptr;
+};
+
+// Running totals a worker republishes after every chunk. Only the owning
+// worker stores (plain relaxed stores, no read-modify-write), so a monitor
+// can read them at any time with relaxed loads without slowing the worker.
+struct ThreadProgress {
+    std::atomic<u64> primes{0};
+    std::atomic<u64> segments{0};
+    std::atomic<u64> max_hi{0};      // Highest segment end sieved so far
+};
+
+// One cache line (or more) per thread: workers write their own result
+// and progress continuously, and must not share lines with each other
+struct alignas(64) ThreadResult {
+    ThreadProgress live;
+
+    // Final totals, written once when the worker returns
+    u64 primes_count = 0;
+    u64 largest_prime = 0;
+    u64 segments_processed = 0;
+    u64 bytes_touched = 0;
+    u64 max_hi_processed = 0;
+    int cpu = -1;               // Last CPU seen, sampled once per chunk
+    u32 migrations = 0;         // CPU changes between those samples
+
+    PhaseTimer phases;          // Empty unless built with SIEVE_PROFILE
+    u64 perf[NUM_PERF_EVENTS] = {~0ULL, ~0ULL, ~0ULL};
+    GapHistogram gaps;          // Gaps inside this thread's completed chunks (--gaps)
+    u64 steals = 0;             // Chunk runs taken from other threads
+    double waited = 0;          // Seconds blocked on the tracker's ring
+    double parked = 0;          // Seconds parked by the governor
+    double seconds = 0;         // From start to return; the rest of the run is idle
+};
+
+template <class W>
+inline void worker(const RunContext* ctx,
+                   unsigned tid,
+                   ThreadResult* out)
+{
+    const RunLimits* limits = &ctx->limits;
+    BasePrimes* base_shared = ctx->base;
+    WorkAllocator* alloc = ctx->alloc;
+    PrimeWriter* writer = ctx->writer;
+    PrimeArchive* archive = ctx->archive;
+    ChunkTracker* tracker = ctx->tracker;
+
+    using clock = std::chrono::steady_clock;
+    auto t0 = clock::now();
+    auto deadline = t0 + std::chrono::duration<double>(limits->seconds);
+    const bool bounded = limits->bounded;
+
+    // Bit-packed flags - one bit per number coprime to W::M. These and the
+    // walked primes are mapped and first touched here, on this thread's
+    // node, with room for every prime below the bucket threshold
+    FixedArray<u64> flags;
+    FixedArray<WalkEntry<W>> sieving;   // Indexed like the base primes
+    size_t walked = prime_count_bound(std::min<u64>(BucketSieve<W>::LARGE_MIN, base_shared->max_root));
+    if (!flags.reserve(W::SEG_U64S, true) || !sieving.reserve(walked, true)) {
+        fprintf(stderr, "worker: cannot map its sieve buffers\n");
+        abort();
+    }
+    flags.resize(W::SEG_U64S, 0);
+
+    const Presieve<W>& presieve = Presieve<W>::get();
+    const SmallMasks<W>& masks = SmallMasks<W>::get();
+    const size_t first_sieving = W::NUM_WHEEL_PRIMES + presieve.num_primes + masks.entries.size();
+    BucketSieve<W> buckets;
+
+    u64 local_count = 0;
+    u64 local_largest = 0;
+    u64 local_segments = 0;
+    u64 local_bytes = 0;
+    u64 local_max_hi = 0;
+    std::unique_ptr<GapHistogram> chunk_gaps(ctx->gaps ? new GapHistogram : nullptr);
+    u64 root = 0, next_square = 0;     // isqrt(hi - 1) of the last segment
+
+    // Allocator chunk ids count from the chunk holding limits->lo
+    const u64 first_seg = limits->lo / W::SEG_SPAN;
+    const u64 last_seg = limits->hi / W::SEG_SPAN;
+    const u64 base_chunk = first_seg / W::CHUNK_SEGS;
+
+    WorkAllocator::Cursor cursor;
+    cursor.tid = tid;
+    u64 chunks_done = 0;
+    u64 expect_seg = 0;         // Segment after the last one sieved
+    double waited = 0;          // Seconds spent blocked on the tracker
+    double parked = 0;          // Seconds parked by the governor
+    OutBlock block;
+
+    PhaseTimer prof;
+    PerfCounters perf;
+    if (ctx->perf) perf.open();
+
+    while (bounded || clock::now() < deadline) {
+        // Parked by the governor: the claimed chunks go back to the others.
+        // A range with nothing left to claim releases the thread to finish
+        if (ctx->active && tid >= ctx->active->load(std::memory_order_relaxed)) {
+            auto p0 = clock::now();
+            alloc->park(tid);
+            while (tid >= ctx->active->load(std::memory_order_relaxed) && !(bounded && alloc->exhausted()) &&
+                   (bounded || clock::now() < deadline)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+            parked += std::chrono::duration<double>(clock::now() - p0).count();
+            if (!bounded && clock::now() >= deadline) break;
+        }
+
+        // Timed runs claim no more than this thread's own pace can finish
+        if (!bounded && chunks_done) {
+            auto now = clock::now();
+            double per_chunk = (std::chrono::duration<double>(now - t0).count() - parked) / chunks_done;
+            cursor.budget = (u64)(std::chrono::duration<double>(deadline - now).count() / per_chunk);
+        }
+        u64 rel_chunk = alloc->get_chunk(cursor);
+        u64 chunk_id = base_chunk + rel_chunk;
+        if (chunk_id > last_seg / W::CHUNK_SEGS) break;     // Timed runs too, at MAX_BOUND
+
+        // Stay within the tracker's ring of the completed prefix
+        bool timed_out = false;
+        if (!tracker->has_room(rel_chunk)) {
+            auto w0 = clock::now();
+            while (!tracker->has_room(rel_chunk)) {
+                if (alloc->swap_orphan(rel_chunk)) {
+                    chunk_id = base_chunk + rel_chunk;
+                    continue;
+                }
+                tracker->advance(false);
+                if (!bounded && clock::now() >= deadline) {
+                    timed_out = true;
+                    break;
+                }
+                std::this_thread::yield();
+            }
+            waited += std::chrono::duration<double>(clock::now() - w0).count();
+        }
+        if (timed_out) break;
+
+        if (writer) block.reset(rel_chunk);
+        u64 chunk_count = 0;
+        u64 chunk_largest = 0;
+        u64 chunk_segments = 0;
+        PrimeStats chunk_stats;
+        if (chunk_gaps) chunk_gaps->clear();
+        bool cut = false;
+
+        int cpu = current_cpu();
+        if (out->cpu >= 0 && cpu != out->cpu) ++out->migrations;
+        out->cpu = cpu;
+
+        for (int seg = 0; seg < W::CHUNK_SEGS; ++seg) {
+            u64 seg_id = chunk_id * W::CHUNK_SEGS + seg;
+            if (seg_id < first_seg) continue;
+            if (seg_id > last_seg) break;
+            u64 bit_lo = seg_id * W::SEG_BITS;
+            u64 lo = seg_id * W::SEG_SPAN;
+            u64 hi = lo + std::min<u64>(W::SEG_SPAN, MAX_BOUND + 1 - lo);   // The last one stops short of 2^64
+
+            prof.start();
+
+            // Walked offsets are relative to the segment after the last
+            // one: any other segment (the next claim, or a stolen chunk
+            // below) sets them up again, one division per prime
+            if (seg_id != expect_seg) sieving.clear();
+            expect_seg = seg_id + 1;
+
+            // Archive runs sieve straight into the segment's mapped block
+            u64* f = archive ? archive->segment(seg_id) : flags.data();
+
+            // Ensure base primes cover sqrt(hi-1), or sqrt of the range's end
+            // when the segment sticks out of it. The integer root only moves
+            // when hi passes the next square, a few times a chunk
+            u64 need = std::min(hi - 1, limits->hi);
+            if (need >= next_square || need < root * root) {
+                root = isqrt(need);
+                next_square = root < 0xFFFFFFFFULL ? (root + 1) * (root + 1) : ~0ULL;
+                base_shared->ensure((u32)std::min<u64>(root, std::numeric_limits<u32>::max()));
+            }
+            const BasePrimes::PrimeList& primes = base_shared->snapshot()->primes;
+
+            // Large primes go to the buckets, the rest are walked below
+            buckets.advance(primes, seg_id, lo, hi);
+
+            // Start the primes whose square now falls below hi (the shared
+            // list can run ahead of this segment, and a far first multiple
+            // would not fit the 32-bit offset)
+            size_t small_end = sieving.size();
+            while (small_end < buckets.large_begin && (u64)primes[small_end] * primes[small_end] < hi) {
+                ++small_end;
+            }
+            if (sieving.size() != small_end) {
+                size_t old = sieving.size();
+                sieving.resize(small_end, WalkEntry<W>{});
+                for (size_t i = std::max(old, first_sieving); i < small_end; ++i) {
+                    sieving[i] = WalkEntry<W>::start(primes[i], lo);
+                }
+            }
+            prof.lap(PH_SETUP);
+
+            // Walk primes [bi_begin, bi_end) over the segment's bits [.., end).
+            // The pass that ends the segment rebases the offsets on the next
+            WalkEntry<W>* entries = sieving.data();
+            auto walk = [&](size_t bi_begin, size_t bi_end, u32 end) {
+                const u32 rebase = end == W::SEG_BITS ? (u32)W::SEG_BITS : 0;
+                for (size_t bi = bi_begin; bi < bi_end; ++bi) {
+                    WalkEntry<W>& e = entries[bi];
+                    u32 idx = e.off;
+                    if (idx >= end) {
+                        e.off = idx - rebase;
+                        continue;
+                    }
+                    const u32 pb = e.prime_bit();
+
+                    if constexpr (W::PHI == 1) {
+                        // Odd-only: consecutive odd multiples are p bits apart
+                        const u32 step = 2 * pb + 1;
+
+                        // Mark composites - unrolled by 4, no bounds checks needed
+                        while (idx + 3*step < end) {
+                            clear_bit(f, idx);
+                            clear_bit(f, idx + step);
+                            clear_bit(f, idx + 2*step);
+                            clear_bit(f, idx + 3*step);
+                            idx += 4 * step;
+                        }
+
+                        // Handle remainder
+                        while (idx < end) {
+                            clear_bit(f, idx);
+                            idx += step;
+                        }
+                        e.off = idx - rebase;
+                    } else {
+                        // Wheel: walk the cofactor residues, gap table by the
+                        // residue class of p (its bit index mod PHI)
+                        const u32 a = pb / W::PHI;
+                        const auto& corr = W::CORR[pb % W::PHI];
+                        u32 wi = e.wi();
+                        while (idx < end) {
+                            clear_bit(f, idx);
+                            idx += a * W::STEP[wi] + corr[wi];
+                            if (++wi == W::PHI) wi = 0;
+                        }
+                        e = {idx - rebase, pb << WalkEntry<W>::WI_BITS | wi};
+                    }
+                }
+            };
+
+            // Primes hitting a sub-segment at least 16 times are walked per
+            // L1-sized sub-segment; the medium ones up to SEG_SPAN touch each
+            // sub-segment only a few times and take one pass over the whole
+            // (L2-sized) segment, so their state is loaded once per segment.
+            // Single-level geometries have one sub-segment, where this is the
+            // plain per-segment sieve. Skip the primes dividing M, the
+            // pre-sieved and masked ones.
+            size_t medium_begin =
+                std::lower_bound(primes.begin(), primes.begin() + small_end, (u32)(W::SUB_BITS / 16)) - primes.begin();
+            medium_begin = std::max(medium_begin, first_sieving);
+            for (u64 sub = 0; sub < W::SEG_BITS; sub += W::SUB_BITS) {
+                // Stamp the pre-sieved pattern (multiples of the smallest primes cleared)
+                presieve.fill(f + sub / 64, bit_lo + sub, W::SUB_U64S);
+                masks.apply(f + sub / 64, bit_lo + sub, W::SUB_U64S);
+                prof.lap(PH_INIT);
+                walk(first_sieving, medium_begin, (u32)(sub + W::SUB_BITS));
+                prof.lap(PH_SMALL);
+            }
+            walk(medium_begin, small_end, (u32)W::SEG_BITS);
+            prof.lap(PH_MEDIUM);
+
+            buckets.sieve(f, seg_id);
+            prof.lap(PH_LARGE);
+
+            // Trim a segment that sticks out of [limits->lo, limits->hi]
+            if (lo < limits->lo) {
+                clear_bits(f, 0, W::bit_of(limits->lo) - bit_lo);
+            }
+            if (hi - 1 > limits->hi) hi = limits->hi + 1;
+            if (hi - lo < W::SEG_SPAN) clear_bits(f, W::bit_of(hi) - bit_lo, W::SEG_BITS);
+
+            // Count primes in this segment
+            u64 seg_count = popcount_array(f, W::SEG_U64S);
+            local_count += seg_count;
+            chunk_count += seg_count;
+            ++chunk_segments;
+            if (archive) archive->index[seg_id - first_seg] = seg_count;
+            if (ctx->on_segment) {
+                SegmentView view{f, W::SEG_U64S, bit_lo, std::max(lo, limits->lo), hi, seg_count, W::M, &W::to_number};
+                ctx->on_segment(ctx->on_segment_user, view);
+            }
+            if (ctx->verifier && ctx->verifier->wants(seg_id)) {
+                VerifySample vs;
+                vs.lo = std::max(lo, limits->lo);
+                vs.hi = hi;
+                vs.skip_below = W::LARGEST_WHEEL_PRIME + 1;
+                vs.count = seg_count;
+                // A few primes at pseudo-random words of the segment
+                for (u32 k = 0; k < 4; ++k) {
+                    size_t w = (size_t)((seg_id * 0x9E3779B97F4A7C15ULL + k * 0xBF58476D1CE4E5B9ULL) >> 40) % W::SEG_U64S;
+                    while (w < W::SEG_U64S && !f[w]) ++w;
+                    if (w == W::SEG_U64S) break;
+                    vs.primes[vs.num_primes++] = W::to_number(bit_lo + w * 64 + __builtin_ctzll(f[w]));
+                }
+                ctx->verifier->submit(vs);
+            }
+            if (ctx->tuples || ctx->gaps) {
+                PrimeStats seg_stats = segment_stats<W>(f, bit_lo, std::max(lo, limits->lo), hi, ctx->tuples,
+                                                        chunk_gaps.get());
+                chunk_stats.merge(seg_stats, chunk_gaps.get());
+            }
+            prof.lap(PH_COUNT);
+
+            // ---- metrics for reality checks ----
+            ++local_segments;
+            local_bytes += W::SEG_U64S * sizeof(u64);
+            if (hi > local_max_hi) local_max_hi = hi;
+
+            // Encode this segment's primes for the writer
+            if (writer) {
+                for (size_t w = 0; w < W::SEG_U64S; ++w) {
+                    for (u64 bits = f[w]; bits; bits &= bits - 1) {
+                        block.add(W::to_number(bit_lo + w * 64 + __builtin_ctzll(bits)));
+                    }
+                }
+                block.end = hi;
+            }
+            prof.lap(PH_OUTPUT);
+
+            // Find largest prime in segment (highest set bit); lite runs
+            // leave it to largest_prime() once the run is over
+            int64_t top = ctx->lite ? -1 : kernels.last_set(f, W::SEG_U64S);
+            if (top >= 0) {
+                u64 p = W::to_number(bit_lo + (u64)top);
+                if (p > local_largest) {
+                    local_largest = p;
+                }
+                chunk_largest = p;
+            }
+            prof.lap(PH_SCAN);
+            
+            // Check deadline
+            if (!bounded && clock::now() >= deadline) {
+                cut = seg + 1 < W::CHUNK_SEGS;
+                break;
+            }
+        }
+
+        if (!cut) {
+            ++chunks_done;
+            bool stats = ctx->tuples || ctx->gaps;
+            tracker->complete(rel_chunk, chunk_count, chunk_largest, chunk_segments, stats ? &chunk_stats : nullptr);
+            if (chunk_gaps) out->gaps.merge(*chunk_gaps);
+        }
+        out->live.primes.store(local_count, std::memory_order_relaxed);
+        out->live.segments.store(local_segments, std::memory_order_relaxed);
+        out->live.max_hi.store(local_max_hi, std::memory_order_relaxed);
+        if (writer) {
+            block.partial = cut;
+            writer->submit(tid, block);
+        }
+
+        if (!bounded && clock::now() >= deadline) break;
+    }
+
+    if (writer) writer->producer_done();
+
+    out->primes_count = local_count;
+    out->largest_prime = local_largest;
+    out->segments_processed = local_segments;
+    out->bytes_touched = local_bytes;
+    out->max_hi_processed = local_max_hi;
+    out->phases = prof;
+    perf.read_all(out->perf);
+    out->steals = cursor.steals;
+    out->waited = waited;
+    out->parked = parked;
+    out->seconds = std::chrono::duration<double>(clock::now() - t0).count();
+}
+
+// Lock-free view of a running pool: sums of the workers' latest published
+// totals. Each value is exact for its worker as of its last chunk; the sum
+// is not one atomic instant, which is fine for progress reporting.
+struct ProgressSnapshot {
+    u64 primes = 0;
+    u64 segments = 0;
+    u64 max_hi = 0;
+};
+
+inline ProgressSnapshot progress_snapshot(const ThreadResult* results, size_t n) {
+    ProgressSnapshot s;
+    for (size_t i = 0; i < n; ++i) {
+        s.primes += results[i].live.primes.load(std::memory_order_relaxed);
+        s.segments += results[i].live.segments.load(std::memory_order_relaxed);
+        s.max_hi = std::max(s.max_hi, results[i].live.max_hi.load(std::memory_order_relaxed));
+    }
+    return s;
+}
+
+// -------------------- Segment geometry --------------------
+// Cache sizes from sysconf, falling back to sysfs (0 when neither knows,
+// which is common on ARM kernels)
+struct CacheInfo {
+    size_t l1d = 0;
+    size_t l2 = 0;
+};
+
+inline size_t sysfs_cache_bytes(int want_level) {
+    for (int idx = 0; idx < 8; ++idx) {
+        std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(idx) + "/";
+        std::ifstream level_in(dir + "level"), type_in(dir + "type"), size_in(dir + "size");
+        int level = 0;
+        std::string type, size;
+        if (!(level_in >> level) || !(type_in >> type) || !(size_in >> size)) continue;
+        if (level != want_level || type == "Instruction") continue;
+        size_t v = strtoull(size.c_str(), nullptr, 10);
+        if (!size.empty() && (size.back() == 'K' || size.back() == 'k')) v *= 1024;
+        if (!size.empty() && size.back() == 'M') v *= 1024 * 1024;
+        return v;
+    }
+    return 0;
+}
+
+inline CacheInfo detect_caches() {
+    CacheInfo c;
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    if (l1 > 0) c.l1d = (size_t)l1;
+#endif
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 > 0) c.l2 = (size_t)l2;
+#endif
+    if (!c.l1d) c.l1d = sysfs_cache_bytes(1);
+    if (!c.l2) c.l2 = sysfs_cache_bytes(2);
+    return c;
+}
+
+// Sieving rate (numbers per second) of one thread starting at lo, for the
+// startup calibration of the segment geometry
+template <class W>
+inline double calibrate_rate(u64 lo, double seconds) {
+    BasePrimes base;
+    base.ensure((u32)std::max<u64>(100, isqrt(lo + std::min<u64>(64 * W::CHUNK_SPAN, MAX_BOUND - lo))));
+    WorkAllocator alloc;
+    alloc.init(1);
+    ChunkTracker tracker;
+    tracker.init(1, 0, 0, 0);
+
+    RunContext ctx;
+    ctx.limits.seconds = seconds;
+    ctx.limits.lo = lo;
+    ctx.base = &base;
+    ctx.alloc = &alloc;
+    ctx.tracker = &tracker;
+
+    ThreadResult r;
+    auto t0 = std::chrono::steady_clock::now();
+    worker<W>(&ctx, 0, &r);
+    double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return r.max_hi_processed > lo && dt > 0 ? (double)(r.max_hi_processed - lo) / dt : 0.0;
+}
+
+// -------------------- Engines --------------------
+template <class W>
+inline int query_archive(const PrimeArchive& ar, const std::string& op, u64 a, u64 b);
+
+using WorkerFn = void (*)(const RunContext*, unsigned, ThreadResult*);
+using ArchiveFn = bool (PrimeArchive::*)(const char*, u64, u64, const std::vector<u64>&);
+using QueryFn = int (*)(const PrimeArchive&, const std::string&, u64, u64);
+using RateFn = double (*)(u64, double);
+
+// Segment layouts, selectable for A/B runs on the same box, each in a few
+// segment geometries. Every geometry keeps a chunk at 512KB of flags, so the
+// scheduling granularity does not change with the segment size: 16KB fits
+// a 32KB L1 (the Pi), 32KB a 48-64KB L1. The two-level 128KB blocks of 16KB
+// sub-segments suit the Pi's 512KB shared L2, 512KB blocks of 32KB the 1-2MB
+// per-core L2 of x86 hosts.
+struct EngineInfo {
+    const char* name;
+    size_t seg_bytes;
+    size_t sub_bytes;   // Below seg_bytes for two-level geometries
+    int chunk_segs;
+    WorkerFn fn;
+    ArchiveFn create_archive;
+    QueryFn query;
+    RateFn rate;
+    u32 modulus;
+    u32 wheel_primes;   // Leading SMALL_PRIMES not stored in the bitmap
+    u64 seg_bits;
+    u64 chunk_span;
+};
+
+template <class W>
+constexpr EngineInfo engine_entry(const char* name) {
+    return {name, W::SEG_BYTES, W::SUB_BYTES, W::CHUNK_SEGS, worker<W>, &PrimeArchive::create<W>, query_archive<W>,
+            calibrate_rate<W>, W::M, W::NUM_WHEEL_PRIMES, W::SEG_BITS, W::CHUNK_SPAN};
+}
+
+inline const EngineInfo ENGINES[] = {
+    engine_entry<OddWheel>("odd"),
+    engine_entry<Wheel<2, 32 * 1024, 16>>("odd"),
+    engine_entry<Wheel<2, 128 * 1024, 4, 16 * 1024>>("odd"),
+    engine_entry<Wheel<2, 512 * 1024, 1, 32 * 1024>>("odd"),
+    engine_entry<Wheel30>("wheel30"),
+    engine_entry<Wheel<30, 32 * 1024, 16>>("wheel30"),
+    engine_entry<Wheel<30, 128 * 1024, 4, 16 * 1024>>("wheel30"),
+    engine_entry<Wheel<30, 512 * 1024, 1, 32 * 1024>>("wheel30"),
+    engine_entry<Wheel210>("wheel210"),
+    engine_entry<Wheel<210, 32 * 1024, 16>>("wheel210"),
+    engine_entry<Wheel<210, 128 * 1024, 4, 16 * 1024>>("wheel210"),
+    engine_entry<Wheel<210, 512 * 1024, 1, 32 * 1024>>("wheel210"),
+};
+
+// Picks the geometry among an engine's candidates: a fixed size ("32k"),
+// "calibrate" to time each one for a combined ~100ms at lo, or "auto" for
+// the largest segment whose (sub-)segments use at most 2/3 of L1d (16KB when
+// L1d is unknown) and whose two-level blocks use at most a quarter of L2.
+// Calibration timings go to log when one is given
+inline const EngineInfo* pick_geometry(const std::vector<const EngineInfo*>& cands, const std::string& mode,
+                                       const CacheInfo& caches, u64 lo, std::ostream* log = nullptr) {
+    if (cands.empty()) return nullptr;
+    if (mode == "calibrate") {
+        const EngineInfo* best = nullptr;
+        double best_rate = -1.0;
+        for (const EngineInfo* e : cands) {
+            double rate = e->rate(lo, 0.1 / cands.size());
+            if (log) {
+                std::ios::fmtflags flags = log->flags();
+                std::streamsize precision = log->precision();
+                *log << "Calibrate: " << e->seg_bytes / 1024 << "KB segments";
+                if (e->sub_bytes < e->seg_bytes) *log << " of " << e->sub_bytes / 1024 << "KB";
+                *log << ", " << std::fixed << std::setprecision(1)
+                     << rate / 1e6 << " M numbers/s per thread\n";
+                log->flags(flags);
+                log->precision(precision);
+            }
+            if (rate > best_rate) {
+                best = e;
+                best_rate = rate;
+            }
+        }
+        return best;
+    }
+    if (mode == "auto") {
+        const EngineInfo* best = nullptr;
+        for (const EngineInfo* e : cands) {
+            bool fits = caches.l1d ? e->sub_bytes * 3 <= caches.l1d * 2 : e->sub_bytes <= 16 * 1024;
+            if (e->sub_bytes < e->seg_bytes) fits = fits && e->seg_bytes * 4 <= caches.l2;
+            if (fits && (!best || e->seg_bytes > best->seg_bytes)) best = e;
+        }
+        if (!best) {
+            best = cands[0];
+            for (const EngineInfo* e : cands) if (e->seg_bytes < best->seg_bytes) best = e;
+        }
+        return best;
+    }
+    for (const EngineInfo* e : cands) {
+        if (mode == std::to_string(e->seg_bytes / 1024) + "k") return e;
+    }
+    return nullptr;
+}
+
+// -------------------- Archive queries --------------------
+// ./optimized_mc_pi --query FILE pi X | nth K | primes A B
+template <class W>
+inline int query_archive(const PrimeArchive& ar, const std::string& op, u64 a, u64 b) {
+    const ArchiveHeader& h = *ar.hdr;
+
+    // Primes <= x in the archived range
+    auto pi = [&](u64 x) -> u64 {
+        if (x < h.lo) return 0;
+        x = std::min(x, h.hi);
+        u64 n = 0;
+        for (u64 i = 0; i < h.lead_count; ++i) n += h.lead[i] <= x;
+        u64 s = x / W::SEG_SPAN - h.first_seg;
+        u64 bits = W::bit_of(x + 1) - (s + h.first_seg) * W::SEG_BITS;
+        const u64* blk = ar.block(s);
+        n += ar.index[s] + popcount_array(blk, bits / 64);
+        if (bits % 64) n += __builtin_popcountll(blk[bits / 64] & ((1ULL << (bits % 64)) - 1));
+        return n;
+    };
+
+    if (op == "pi") {
+        if (a > h.hi) std::cerr << "Note: " << a << " is past the archive, answering for " << h.hi << "\n";
+        std::cout << pi(a) << "\n";
+    } else if (op == "nth") {
+        if (a == 0 || a > ar.total()) {
+            std::cerr << "The archive holds " << ar.total() << " primes\n";
+            return 1;
+        }
+        if (a <= h.lead_count) {
+            std::cout << h.lead[a - 1] << "\n";
+            return 0;
+        }
+        u64 k = a - h.lead_count;
+        // Last segment with index[s] < k, then walk its words
+        u64 s = (u64)(std::upper_bound(ar.index, ar.index + h.num_segs, k - 1) - ar.index) - 1;
+        k -= ar.index[s];
+        const u64* blk = ar.block(s);
+        for (u64 w = 0; w < h.seg_u64s; ++w) {
+            u64 c = __builtin_popcountll(blk[w]);
+            if (k > c) {
+                k -= c;
+                continue;
+            }
+            u64 bits = blk[w];
+            while (--k) bits &= bits - 1;
+            std::cout << W::to_number((s + h.first_seg) * W::SEG_BITS + w * 64 + __builtin_ctzll(bits)) << "\n";
+            return 0;
+        }
+    } else if (op == "primes") {
+        a = std::max(a, h.lo);
+        b = std::min(b, h.hi);
+        for (u64 i = 0; i < h.lead_count; ++i) {
+            if (h.lead[i] >= a && h.lead[i] <= b) std::cout << h.lead[i] << "\n";
+        }
+        if (a > b) return 0;
+        u64 from = W::bit_of(a), to = W::bit_of(b + 1);
+        u64 bit0 = h.first_seg * W::SEG_BITS;
+        for (u64 bit = from; bit < to; ) {
+            u64 rel = bit - bit0;
+            u64 word = ar.block(rel / W::SEG_BITS)[(rel % W::SEG_BITS) / 64] >> (rel % 64);
+            u64 span = std::min<u64>(64 - rel % 64, to - bit);
+            if (span < 64) word &= (1ULL << span) - 1;
+            for (; word; word &= word - 1) std::cout << W::to_number(bit + __builtin_ctzll(word)) << "\n";
+            bit += span;
+        }
+    } else {
+        std::cerr << "Unknown query '" << op << "' (expected pi, nth or primes)\n";
+        return 1;
+    }
+    return 0;
+}
+
+// -------------------- Library API --------------------
+// Exact count of a bounded range [lo, hi] on threads workers, optionally
+// calling on_segment for every finished segment (from the worker threads;
+// in increasing order when threads == 1)
+struct RangeResult {
+    u64 primes = 0;
+    u64 segments = 0;
+    double seconds = 0;         // Sieving time, without the setup
+};
+
+// With count_range(): the pair counts (pairs) and gap histogram (gaps) of
+// the whole range, wheel primes included
+struct RangeStats {
+    bool pairs = false;
+    bool gaps = false;
+    PrimeStats stats;
+    GapHistogram hist;
+};
+
+inline RangeResult count_range(const EngineInfo* info, u64 lo, u64 hi, unsigned threads,
+                               void (*on_segment)(void*, const SegmentView&) = nullptr, void* user = nullptr,
+                               RangeStats* stats = nullptr) {
+    RangeResult out;
+    hi = std::min(hi, MAX_BOUND);
+    if (lo > hi) return out;
+    BasePrimes base(isqrt(hi));
+    base.ensure((u32)std::max<u64>(100, isqrt(hi)));
+    WorkAllocator alloc;
+    alloc.init(threads);
+    alloc.total_chunks = hi / info->chunk_span - lo / info->chunk_span + 1;
+    ChunkTracker tracker;
+    tracker.init(threads, 0, 0, 0);
+
+    RunContext ctx;
+    ctx.limits.bounded = true;
+    ctx.limits.lo = lo;
+    ctx.limits.hi = hi;
+    ctx.base = &base;
+    ctx.alloc = &alloc;
+    ctx.tracker = &tracker;
+    ctx.lite = true;
+    if (stats) {
+        ctx.tuples = stats->pairs;
+        ctx.gaps = stats->gaps;
+        if (stats->gaps) tracker.boundary_gaps = &stats->hist;
+    }
+    ctx.on_segment = on_segment;
+    ctx.on_segment_user = user;
+
+    std::vector<ThreadResult> results(threads);
+    std::vector<std::thread> pool;
+    auto t0 = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < threads; ++i) pool.emplace_back(info->fn, &ctx, i, &results[i]);
+    for (auto& th : pool) th.join();
+    out.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    tracker.advance(true);
+    u64 wm, maxp;
+    tracker.snapshot(wm, out.primes, maxp);
+    for (u32 k = 0; k < info->wheel_primes; ++k) out.primes += SMALL_PRIMES[k] >= lo && SMALL_PRIMES[k] <= hi;
+    for (const auto& r : results) out.segments += r.segments_processed;
+    if (stats) {
+        stats->stats = tracker.stats_snapshot();
+        std::vector<u64> wheel;
+        for (u32 k = 0; k < info->wheel_primes; ++k) {
+            if (SMALL_PRIMES[k] >= lo && SMALL_PRIMES[k] <= hi) wheel.push_back(SMALL_PRIMES[k]);
+        }
+        add_wheel_primes(stats->stats, wheel, lo, hi + 1, stats->gaps ? &stats->hist : nullptr);
+        for (const auto& r : results) stats->hist.merge(r.gaps);
+    }
+    return out;
+}
+
+// Largest prime in [lo, hi], 0 if there is none. Sieves back from hi one
+// segment span at a time, doubling, so this is the only place a lite run
+// scans for it
+inline u64 largest_prime(const EngineInfo* info, u64 lo, u64 hi) {
+    u64 best = 0;
+    for (u32 k = 0; k < info->wheel_primes; ++k) {
+        if (SMALL_PRIMES[k] >= lo && SMALL_PRIMES[k] <= hi) best = SMALL_PRIMES[k];
+    }
+    auto top = [](void* user, const SegmentView& v) {
+        u64& p = *(u64*)user;
+        for (size_t w = v.words; w-- > 0;) {
+            if (v.bitmap[w]) {
+                p = std::max(p, v.number(w * 64 + 63 - __builtin_clzll(v.bitmap[w])));
+                return;
+            }
+        }
+    };
+    u64 span = info->chunk_span / info->chunk_segs;
+    for (u64 end = hi;;) {
+        u64 start = end - lo >= span ? end - span + 1 : lo;
+        u64 p = 0;
+        count_range(info, start, end, 1, top, &p);
+        if (p) return std::max(best, p);
+        if (start == lo) return best;
+        end = start - 1;
+        span *= 2;
+    }
+}
+
+// The engines as a reusable object:
+//   PrimeSieve ps("wheel30");               // engine, segment geometry ("auto")
+//   ps.count_primes(lo, hi, threads)        // primes in [lo, hi]
+//   for (auto it = ps.begin(x); it != ps.end(); ++it)  // primes >= x, in order
+//   ps.for_each_prime_segment(lo, hi, f)    // f(const SegmentView&) per segment
+// The segment callback runs on one worker, in increasing order; the primes
+// dividing the wheel modulus (2, 3, 5, 7) are not in any bitmap, so callers
+// that need them use small_primes().
+class PrimeSieve {
+public:
+    explicit PrimeSieve(const std::string& engine = "wheel30", const std::string& segment = "auto") {
+        std::vector<const EngineInfo*> cands;
+        for (const auto& e : ENGINES) if (engine == e.name) cands.push_back(&e);
+        info_ = pick_geometry(cands, segment, detect_caches(), 0);
+    }
+
+    // False for an unknown engine or segment name
+    bool ok() const { return info_ != nullptr; }
+    const EngineInfo* engine() const { return info_; }
+
+    u64 count_primes(u64 lo, u64 hi, unsigned threads = 1) const {
+        return info_ ? count_range(info_, lo, hi, std::max(1u, threads)).primes : 0;
+    }
+
+    // Primes in [lo, hi] that no bitmap holds (those dividing the modulus)
+    std::vector<u64> small_primes(u64 lo, u64 hi) const {
+        std::vector<u64> out;
+        for (u32 k = 0; info_ && k < info_->wheel_primes; ++k) {
+            if (SMALL_PRIMES[k] >= lo && SMALL_PRIMES[k] <= hi) out.push_back(SMALL_PRIMES[k]);
+        }
+        return out;
+    }
+
+    template <class F>
+    void for_each_prime_segment(u64 lo, u64 hi, F&& callback) const {
+        if (!info_) return;
+        using Fn = typename std::remove_reference<F>::type;
+        count_range(info_, lo, hi, 1, [](void* user, const SegmentView& view) { (*static_cast<Fn*>(user))(view); },
+                    &callback);
+    }
+
+    // Forward iterator over the primes >= start, sieving one window at a time.
+    // Past the last prime below 2^64 it holds the sentinel ~0ULL (2^64 - 1,
+    // not a prime), which is what end() holds
+    class prime_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = u64;
+        using difference_type = ptrdiff_t;
+        using pointer = const u64*;
+        using reference = const u64&;
+
+        prime_iterator(const PrimeSieve* ps, u64 start) : ps_(ps), next_lo_(start) { refill(); }
+        // The sentinel, without sieving
+        explicit prime_iterator(const PrimeSieve* ps) : ps_(ps), next_lo_(~0ULL), buf_(1, ~0ULL) {}
+
+        reference operator*() const { return buf_[pos_]; }
+        pointer operator->() const { return &buf_[pos_]; }
+
+        prime_iterator& operator++() {
+            if (++pos_ == buf_.size()) refill();
+            return *this;
+        }
+        prime_iterator operator++(int) {
+            prime_iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const prime_iterator& o) const { return **this == *o; }
+        bool operator!=(const prime_iterator& o) const { return !(*this == o); }
+
+    private:
+        const PrimeSieve* ps_;
+        u64 next_lo_;
+        u64 window_ = 0;
+        std::vector<u64> buf_;
+        size_t pos_ = 0;
+
+        // Windows start at one chunk and double up to 64, so short scans stay
+        // cheap and long ones amortise each window's sieve start-up
+        void refill() {
+            buf_.clear();
+            pos_ = 0;
+            const u64 chunk = ps_->info_ ? ps_->info_->chunk_span : 0;
+            if (!chunk) {
+                buf_.push_back(~0ULL);
+                return;
+            }
+            while (buf_.empty()) {
+                window_ = window_ ? std::min<u64>(window_ * 2, 64 * chunk) : chunk;
+                u64 lo = next_lo_;
+                if (lo > MAX_BOUND) {
+                    buf_.push_back(~0ULL);
+                    break;
+                }
+                u64 hi = lo + std::min<u64>(window_ - 1, MAX_BOUND - lo);
+                buf_ = ps_->small_primes(lo, hi);
+                ps_->for_each_prime_segment(lo, hi, [&](const SegmentView& s) {
+                    for (size_t w = 0; w < s.words; ++w) {
+                        for (u64 bits = s.bitmap[w]; bits; bits &= bits - 1) {
+                            u64 n = s.number(w * 64 + __builtin_ctzll(bits));
+                            if (n >= s.lo && n < s.hi) buf_.push_back(n);
+                        }
+                    }
+                });
+                next_lo_ = hi + 1;
+                if (hi == MAX_BOUND) {
+                    if (buf_.empty()) buf_.push_back(~0ULL);
+                    break;
+                }
+            }
+        }
+    };
+
+    prime_iterator begin(u64 start = 0) const { return prime_iterator(this, start); }
+    prime_iterator end() const { return prime_iterator(this); }
+
+private:
+    const EngineInfo* info_ = nullptr;
+};
+
+} // namespace prime_sieve